@@ -0,0 +1,187 @@
+// Pack benchmark corpus - synthetic journeys (JSON, ECEF and time, as logged) for packbench golden checks
+// Real journeys contain personal location data, so the committed corpus is made by this, and is the same every run
+
+#include <stdio.h>
+#include <string.h>
+#include <popt.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <err.h>
+#include <math.h>
+
+int debug = 0;
+
+static uint64_t seed = 1;
+
+double
+rnd (void)
+{                               // 0 to 1, own generator, so same on any host
+   seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+   return (seed >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double
+gauss (void)
+{                               // Normal, mean 0, sd 1
+   double u = rnd (),
+      v = rnd ();
+   return sqrt (-2 * log (u ? : 1e-12)) * cos (2 * M_PI * v);
+}
+
+typedef struct track_s track_t;
+struct track_s
+{                               // Journey being made, local east/north (metres) from a base point
+   FILE *o;
+   double lat,
+     lon;                       // Base (radians)
+   double bx,
+     by,
+     bz;                        // Base ECEF
+   double e,
+     n,
+     u;                         // Position
+   double heading;              // Radians from north
+   double noise;                // GPS noise (metres sd)
+   int64_t t;                   // Time (us)
+   int seq;
+};
+
+void
+um (FILE * o, const char *tag, int64_t v)
+{                               // As logjson, um as metres, no decimal places if whole
+   fprintf (o, "\"%s\":%s%lld", tag, v < 0 ? "-" : "", (long long) (llabs (v) / 1000000LL));
+   if (v % 1000000LL)
+      fprintf (o, ".%06lld", (long long) (llabs (v) % 1000000LL));
+}
+
+void
+fix (track_t * k)
+{                               // Output fix at current position and time
+   double e = k->e + k->noise * gauss (),
+      n = k->n + k->noise * gauss (),
+      u = k->u + k->noise * gauss () / 2;
+   double x = k->bx - sin (k->lon) * e - sin (k->lat) * cos (k->lon) * n + cos (k->lat) * cos (k->lon) * u,
+      y = k->by + cos (k->lon) * e - sin (k->lat) * sin (k->lon) * n + cos (k->lat) * sin (k->lon) * u,
+      z = k->bz + cos (k->lat) * n + sin (k->lat) * u;
+   fprintf (k->o, "%s\n{\"seq\":%d,\"ecef\":{", k->seq ? "," : "", k->seq + 1);
+   um (k->o, "x", llround (x * 1000000));
+   fputc (',', k->o);
+   um (k->o, "y", llround (y * 1000000));
+   fputc (',', k->o);
+   um (k->o, "z", llround (z * 1000000));
+   fputc (',', k->o);
+   um (k->o, "t", k->t);
+   fprintf (k->o, "}}");
+   k->seq++;
+}
+
+void
+drive (track_t * k, int secs, double speed, double turn)
+{                               // Drive, 1Hz, speed m/s, turning at turn degrees per second
+   while (secs--)
+   {
+      k->heading += turn * M_PI / 180;
+      k->e += speed * sin (k->heading);
+      k->n += speed * cos (k->heading);
+      k->t += 1000000;
+      fix (k);
+   }
+}
+
+track_t *
+start (const char *dir, const char *name, double noise)
+{
+   track_t *k = calloc (1, sizeof (*k));
+   char *fn = NULL;
+   asprintf (&fn, "%s/%s.json", dir, name);
+   if (!k || !fn || !(k->o = fopen (fn, "w")))
+      err (1, "Cannot write %s", fn);
+   free (fn);
+   k->lat = 51.5 * M_PI / 180;
+   k->lon = -0.1 * M_PI / 180;
+   double a = 6378137,
+      e2 = 6.69437999014e-3,
+      h = 30,
+      r = a / sqrt (1 - e2 * sin (k->lat) * sin (k->lat));
+   k->bx = (r + h) * cos (k->lat) * cos (k->lon);
+   k->by = (r + h) * cos (k->lat) * sin (k->lon);
+   k->bz = (r * (1 - e2) + h) * sin (k->lat);
+   k->noise = noise;
+   k->t = 1714521600LL * 1000000LL;
+   fprintf (k->o, "{\"gps\":[");
+   fix (k);
+   return k;
+}
+
+void
+end (track_t * k)
+{
+   fprintf (k->o, "\n]}\n");
+   if (fclose (k->o))
+      err (1, "Write failed");
+   free (k);
+}
+
+int
+main (int argc, const char *argv[])
+{
+   const char *dir = "bench";
+   poptContext optCon;          // context for parsing command-line options
+   {                            // POPT
+      const struct poptOption optionsTable[] = {
+         {"dir", 'd', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &dir, 0, "Directory for journeys", "path"},
+         {"debug", 'v', POPT_ARG_NONE, &debug, 0, "Debug"},
+         POPT_AUTOHELP {}
+      };
+
+      optCon = poptGetContext (NULL, argc, argv, optionsTable, 0);
+
+      int c;
+      if ((c = poptGetNextOpt (optCon)) < -1)
+         errx (1, "%s: %s\n", poptBadOption (optCon, POPT_BADOPTION_NOALIAS), poptStrerror (c));
+
+      if (poptPeekArg (optCon))
+      {
+         poptPrintUsage (optCon, stderr, 0);
+         return -1;
+      }
+   }
+   track_t *k;
+   // Straight, motorway
+   k = start (dir, "straight", 0);
+   k->heading = M_PI / 4;
+   drive (k, 300, 31, 0);
+   end (k);
+   // Curved, sweeping bends of different radius, and a roundabout
+   k = start (dir, "curved", 0);
+   for (int b = 0; b < 6; b++)
+   {
+      drive (k, 60, 20, 0);
+      drive (k, 30 + b * 10, 20, (b & 1 ? -1 : 1) * (0.5 + b * 0.3));
+   }
+   drive (k, 20, 8, 0);
+   drive (k, 25, 8, 10);        // Round a roundabout
+   drive (k, 60, 15, 0);
+   end (k);
+   // Stop/start, town, stopping at junctions and turning corners
+   k = start (dir, "stopstart", 0);
+   for (int j = 0; j < 12; j++)
+   {
+      drive (k, 20 + (int) (rnd () * 40), 12, 0);
+      drive (k, 5, 6, 0);       // Slowing
+      drive (k, 10 + (int) (rnd () * 50), 0, 0);        // Stopped
+      drive (k, 9, 5, (rnd () < 0.5 ? -10 : 10));       // Corner
+   }
+   end (k);
+   // Noisy, curved and stopped with GPS noise, as in a town with tall buildings
+   k = start (dir, "noisy", 3);
+   for (int j = 0; j < 8; j++)
+   {
+      drive (k, 40, 14, 0);
+      drive (k, 30, 10, (j & 1 ? 2 : -3));
+      drive (k, 20, 0, 0);
+   }
+   end (k);
+   poptFreeContext (optCon);
+   return 0;
+}
@@ -0,0 +1,458 @@
+// Binary log conversion - convert compact binary logs to JSON or GPX, or JSON to binary for comparison
+
+#include <stdio.h>
+#include <string.h>
+#include <popt.h>
+#include <time.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <err.h>
+#include <ajl.h>
+#include <math.h>
+#include "logjson.h"
+#include "logz.h"
+#include "loggpx.h"
+#include "logconv.h"
+#include "jsonfix.h"
+
+int debug = 0;
+int gpx = 0;
+int check = 0;
+int repeat = 1;
+int gzip = 6;
+
+static int
+gzcount (void *arg, const uint8_t * data, size_t len)
+{                               // Count compressed bytes
+   *(size_t *) arg += len;
+   return 0;
+}
+
+size_t
+gzsize (const char *data, size_t len, double *secs)
+{                               // Compress as on device, i.e. in stdio buffer sized writes, returns compressed size
+   size_t size = 0;
+   struct timespec t0,
+     t1;
+   clock_gettime (CLOCK_MONOTONIC, &t0);
+   for (int r = 0; r < repeat; r++)
+   {
+      size = 0;
+      logz_t *z = logz_init (gzip, gzcount, &size);
+      if (!z)
+         errx (1, "Cannot compress");
+      for (size_t p = 0; p < len; p += BUFSIZ)
+         logz_write (z, data + p, len - p < BUFSIZ ? len - p : BUFSIZ);
+      logz_finish (z);
+   }
+   clock_gettime (CLOCK_MONOTONIC, &t1);
+   *secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1000000000.0;
+   return size;
+}
+
+char *
+tree_fix (fix_t * f, uint32_t fields, uint8_t errors)
+{                               // As log_line used to, building an object and then making a malloc'd string, using AJL as jo_t is not on host
+   j_t j = j_create ();
+   char ts[30];
+   if (f->sett && logjson_ts (ts, f->ecef.t))
+      j_store_string (j, "ts", ts);
+   if (fields & LOGBIN_SEQ)
+      j_store_int (j, "seq", f->seq);
+   if ((fields & LOGBIN_SATS) && f->sats + f->slow.gsa[0] + f->slow.gsa[1] + f->slow.gsa[2])
+   {
+      j_t s = j_store_object (j, "sats");
+      for (int q = 0; q < SYSTEMS; q++)
+         if (f->slow.gsa[q])
+            j_store_int (s, system_name[q], f->slow.gsa[q]);
+      if (f->sats)
+         j_store_int (s, "used", f->sats);
+   }
+   if (f->slow.fixmode)
+      j_store_int (j, "fixmode", f->slow.fixmode);
+   if ((fields & LOGBIN_LLA) && f->setlla && f->quality)
+   {
+      j_store_literalf (j, "lat", "%.8lf", f->lat);
+      j_store_literalf (j, "lon", "%.8lf", f->lon);
+      if (f->slow.fixmode >= 3 && !isnan (f->alt))
+         j_store_literalf (j, "alt", "%.2f", f->alt);
+      j_store_int (j, "quality", f->quality);
+   }
+   if ((fields & LOGBIN_UND) && f->slow.fixmode >= 3 && !isnan (f->und))
+      j_store_literalf (j, "und", "%.2f", f->und);
+   if ((fields & LOGBIN_EPE) && f->setepe && f->slow.fixmode >= 1)
+   {
+      if (f->hepe > 0)
+         j_store_literalf (j, "hepe", "%.2f", f->hepe);
+      if (f->vepe > 0 && f->slow.fixmode >= 3)
+         j_store_literalf (j, "vepe", "%.2f", f->vepe);
+   }
+   if (fields & LOGBIN_DOP)
+   {
+      if (!isnan (f->hdop) && f->hdop)
+         j_store_literalf (j, "hdop", "%.1f", f->hdop);
+      if (!isnan (f->slow.pdop) && f->slow.pdop)
+         j_store_literalf (j, "pdop", "%.1f", f->slow.pdop);
+      if (!isnan (f->slow.vdop) && f->slow.vdop && f->slow.fixmode >= 3)
+         j_store_literalf (j, "vdop", "%.1f", f->slow.vdop);
+   }
+   uint8_t speed = (f->quality && !isnan (f->slow.speed) && f->slow.speed != 0);
+   if ((fields & LOGBIN_CS) && speed)
+   {
+      j_store_literalf (j, "speed", "%.2f", f->slow.speed);
+      if (!isnan (f->slow.course))
+         j_store_literalf (j, "course", "%.2f", f->slow.course);
+   }
+   if ((fields & LOGBIN_MPH) && speed)
+      j_store_literalf (j, "mph", "%.2f", f->slow.speed / 1.609344);
+   if (f->setecef && (fields & LOGBIN_ECEF))
+   {
+      j_t e = j_store_object (j, "ecef");
+      void o (const char *t, int64_t v)
+      {
+         char *s = "";
+         if (v < 0)
+         {
+            v = 0 - v;
+            s = "-";
+         }
+         if (v % 1000000LL)
+            j_store_literalf (e, t, "%s%lld.%06lld", s, (long long) v / 1000000LL, (long long) v % 1000000LL);
+         else
+            j_store_literalf (e, t, "%s%lld", s, (long long) v / 1000000LL);
+      }
+      o ("x", f->ecef.x);
+      o ("y", f->ecef.y);
+      o ("z", f->ecef.z);
+      if (f->sett)
+         o ("t", f->ecef.t);
+   }
+   if (f->setacc && (fields & LOGBIN_ACC))
+   {
+      j_t a = j_store_object (j, "acc");
+      j_store_literalf (a, "x", "%.3f", f->acc.x);
+      j_store_literalf (a, "y", "%.3f", f->acc.y);
+      j_store_literalf (a, "z", "%.3f", f->acc.z);
+      if (f->accmove)
+         j_store_true (a, "move");
+      if (f->acccrash)
+         j_store_true (a, "crash");
+   }
+   if ((fields & LOGBIN_DSQ) && !isnan (f->dsq))
+      j_store_literalf (j, "dsq", "%f", f->dsq);
+   if ((fields & LOGBIN_ODO) && f->setodo && f->odo >= ODOBASE)
+      j_store_literalf (j, "odo", "%llu.%02llu", (unsigned long long) f->odo / 100LL, (unsigned long long) f->odo % 100LL);
+   if (errors)
+      j_store_int (j, "errors", errors);
+   if (f->home && f->setecef)
+      j_store_true (j, "home");
+   if (f->waypoint)
+      j_store_true (j, "waypoint");
+   char *l = j_write_str (j);
+   j_delete (&j);
+   return l;
+}
+
+void
+encode (const char *fn, const char *ofn)
+{                               // JSON log to binary, for comparison
+   FILE *i = fopen (fn, "r");
+   if (!i)
+      err (1, "Cannot open %s", fn);
+   char *text = NULL;
+   size_t textlen = 0;
+   {
+      FILE *t = open_memstream (&text, &textlen);
+      char buf[4096];
+      size_t l;
+      while ((l = fread (buf, 1, sizeof (buf), i)) > 0)
+         fwrite (buf, l, 1, t);
+      fclose (t);
+      fclose (i);
+   }
+   j_t j = j_create ();
+   const char *e = j_read_file (j, fn);
+   if (e)
+   {
+      warnx ("Failed %s: %s", fn, e);
+      j_delete (&j);
+      free (text);
+      return;
+   }
+   int n = 0;
+   for (j_t g = j_first (j_find (j, "gps")); g; g = j_next (g))
+      n++;
+   fix_t *fixes = calloc (n ? : 1, sizeof (*fixes));
+   uint8_t *errors = calloc (n ? : 1, 1);
+   if (!fixes || !errors)
+      errx (1, "malloc");
+   // Fields to log, from what was logged
+   uint32_t fields = 0;
+   n = 0;
+   for (j_t g = j_first (j_find (j, "gps")); g; g = j_next (g), n++)
+      fields |= json_fix (g, &fixes[n], &errors[n]);
+   j_delete (&j);
+   // Start and end records, from text as written on device
+   char *start = NULL,
+      *end = NULL;
+   {
+      char *g = strstr (text, "\"gps\":[");
+      char *x = strstr (text, "\r\n ],\r\n");
+      if (g && x)
+      {
+         asprintf (&start, "%.*s]}", (int) (g + 7 - text), text);
+         x += 7;
+         int l = strlen (x);
+         while (l && isspace (x[l - 1]))
+            l--;
+         asprintf (&end, "{%.*s", l, x);
+      } else
+         warnx ("Start/end not found in %s", fn);
+   }
+   // Encode
+   char *bin = NULL;
+   size_t binlen = 0;
+   struct timespec t0,
+     t1;
+   clock_gettime (CLOCK_MONOTONIC, &t0);
+   for (int r = 0; r < repeat; r++)
+   {
+      free (bin);
+      FILE *o = open_memstream (&bin, &binlen);
+      uint8_t buf[LOGBIN_MAX];
+      fwrite (LOGBIN_MAGIC, sizeof (LOGBIN_MAGIC) - 1, 1, o);
+      if (start)
+      {
+         fwrite (buf, logbin_header (buf, LOGBIN_JSON, strlen (start)), 1, o);
+         fwrite (start, strlen (start), 1, o);
+      }
+      logbin_t s = { 0 };
+      for (int q = 0; q < n; q++)
+         fwrite (buf, logbin_fix (&s, buf, &fixes[q], fields, 0, errors[q]), 1, o);
+      if (end)
+      {
+         fwrite (buf, logbin_header (buf, LOGBIN_JSON, strlen (end)), 1, o);
+         fwrite (end, strlen (end), 1, o);
+      }
+      fclose (o);
+   }
+   clock_gettime (CLOCK_MONOTONIC, &t1);
+   double binsecs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1000000000.0;
+   // JSON encode, as on device, and as it used to be on device
+   clock_gettime (CLOCK_MONOTONIC, &t0);
+   size_t jsonlen = 0;
+   for (int r = 0; r < repeat; r++)
+      for (int q = 0; q < n; q++)
+      {
+         char l[LOGJSON_MAX];
+         jsonlen += logjson_fix (l, sizeof (l), &fixes[q], fields, 0, errors[q]);
+      }
+   clock_gettime (CLOCK_MONOTONIC, &t1);
+   double jsonsecs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1000000000.0;
+   clock_gettime (CLOCK_MONOTONIC, &t0);
+   size_t treelen = 0;
+   for (int r = 0; r < repeat; r++)
+      for (int q = 0; q < n; q++)
+      {
+         char *l = tree_fix (&fixes[q], fields, errors[q]);
+         treelen += strlen (l);
+         free (l);
+      }
+   clock_gettime (CLOCK_MONOTONIC, &t1);
+   double treesecs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1000000000.0;
+   // GPX, as on device
+   clock_gettime (CLOCK_MONOTONIC, &t0);
+   char *gpxtext = NULL;
+   size_t gpxlen = 0;
+   for (int r = 0; r < repeat; r++)
+   {
+      free (gpxtext);
+      FILE *o = open_memstream (&gpxtext, &gpxlen);
+      for (int q = 0; q < n; q++)
+      {
+         char l[LOGGPX_MAX];
+         fwrite (l, loggpx_fix (l, sizeof (l), &fixes[q], fields, 0, errors[q]), 1, o);
+      }
+      fclose (o);
+   }
+   clock_gettime (CLOCK_MONOTONIC, &t1);
+   double gpxsecs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1000000000.0;
+   if (jsonlen != treelen)
+      warnx ("%s: JSON lines differ in length from tree (%zu/%zu)", fn, jsonlen / repeat, treelen / repeat);
+   // Back to JSON
+   clock_gettime (CLOCK_MONOTONIC, &t0);
+   for (int r = 0; r < repeat; r++)
+   {
+      char *json = NULL;
+      size_t jsonlen = 0;
+      FILE *o = open_memstream (&json, &jsonlen);
+      FILE *i = fmemopen (bin, binlen, "r");
+      logconv (i, o, gpx ? LOGCONV_GPX : LOGCONV_JSON);
+      fclose (i);
+      fclose (o);
+      if (check && !r)
+      {                         // Compare
+         int diff = 0;
+         char *a = text,
+            *b = json;
+         while (*a || *b)
+         {
+            size_t al = strcspn (a, "\n"),
+               bl = strcspn (b, "\n");
+            if (al != bl || strncmp (a, b, al))
+            {
+               if (debug)
+                  fprintf (stderr, "-%.*s\n+%.*s\n", (int) al, a, (int) bl, b);
+               diff++;
+            }
+            a += al + (a[al] == '\n');
+            b += bl + (b[bl] == '\n');
+         }
+         if (diff)
+            warnx ("%s: %d lines differ on conversion back to JSON", fn, diff);
+      }
+      free (json);
+   }
+   clock_gettime (CLOCK_MONOTONIC, &t1);
+   double decodesecs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1000000000.0;
+   double us (double secs)
+   {
+      return n ? secs * 1000000 / repeat / n : 0;
+   }
+   printf ("%s: %d fixes, JSON %zu bytes (%.1f/fix), binary %zu bytes (%.1f/fix, %.1f%%), encode %.2fus/fix, decode to JSON %.2fus/fix\n",
+           fn, n, textlen, n ? (double) textlen / n : 0, binlen, n ? (double) binlen / n : 0, textlen ? 100.0 * binlen / textlen : 0,
+           us (binsecs), us (decodesecs));
+   printf ("%s: JSON line %.2fus/fix, JSON line via object %.2fus/fix\n", fn, us (jsonsecs), us (treesecs));
+   printf ("%s: GPX trkpt with extensions %zu bytes (%.1f/fix, JSON line %.1f/fix), %.2fus/fix\n", fn, gpxlen, n ? (double) gpxlen / n : 0,
+           n ? (double) jsonlen / repeat / n : 0, us (gpxsecs));
+   {                            // Minimal and full log profiles
+      const struct
+      {
+         const char *name;
+         uint32_t fields;
+      } profile[] = {
+         {"minimal", LOGBIN_LLA},
+         {"full", LOGBIN_SEQ | LOGBIN_SATS | LOGBIN_LLA | LOGBIN_UND | LOGBIN_EPE | LOGBIN_DOP | LOGBIN_CS | LOGBIN_MPH | LOGBIN_ECEF |
+          LOGBIN_ACC | LOGBIN_DSQ | LOGBIN_ODO},
+      };
+      for (int p = 0; p < sizeof (profile) / sizeof (*profile); p++)
+      {
+         logjson_plan_t plan;
+         logjson_plan (&plan, profile[p].fields);
+         size_t len = 0;
+         clock_gettime (CLOCK_MONOTONIC, &t0);
+         for (int r = 0; r < repeat; r++)
+            for (int q = 0; q < n; q++)
+            {
+               char l[LOGJSON_MAX];
+               len += logjson_fix_plan (l, sizeof (l), &fixes[q], &plan, 0, errors[q]);
+            }
+         clock_gettime (CLOCK_MONOTONIC, &t1);
+         double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1000000000.0;
+         printf ("%s: JSON line %s profile %.1f bytes/fix, %.2fus/fix, %.0f fixes/s\n", fn, profile[p].name, n ? (double) len / repeat / n : 0,
+                 us (secs), secs > 0 ? n * repeat / secs : 0);
+      }
+   }
+   if (gzip)
+   {
+      double jsonzsecs,
+        binzsecs;
+      size_t jsonz = gzsize (text, textlen, &jsonzsecs),
+         binz = gzsize (bin, binlen, &binzsecs);
+      double gpxzsecs;
+      size_t gpxz = gzsize (gpxtext, gpxlen, &gpxzsecs);
+      printf ("%s: gzip %d GPX trkpts %zu bytes (%.1f/fix, %.1f%%) %.2fus/fix\n", fn, gzip, gpxz, n ? (double) gpxz / n : 0,
+              gpxlen ? 100.0 * gpxz / gpxlen : 0, us (gpxzsecs));
+      printf ("%s: gzip %d JSON %zu bytes (%.1f/fix, %.1f%%) %.2fus/fix, binary %zu bytes (%.1f/fix, %.1f%%) %.2fus/fix\n",
+              fn, gzip, jsonz, n ? (double) jsonz / n : 0, textlen ? 100.0 * jsonz / textlen : 0, us (jsonzsecs),
+              binz, n ? (double) binz / n : 0, textlen ? 100.0 * binz / textlen : 0, us (binzsecs));
+   }
+   if (ofn)
+   {
+      FILE *o = fopen (ofn, "w");
+      if (!o)
+         err (1, "Cannot open %s", ofn);
+      fwrite (bin, binlen, 1, o);
+      fclose (o);
+   }
+   free (bin);
+   free (gpxtext);
+   free (start);
+   free (end);
+   free (fixes);
+   free (errors);
+   free (text);
+}
+
+int
+main (int argc, const char *argv[])
+{
+   const char *outfile = NULL;
+   int doencode = 0;
+   int nowrite = 0;
+   poptContext optCon;          // context for parsing command-line options
+   {                            // POPT
+      const struct poptOption optionsTable[] = {
+         {"out-file", 'o', POPT_ARG_STRING, &outfile, 0, "Single output file", "filename"},
+         {"gpx", 'g', POPT_ARG_NONE, &gpx, 0, "Convert to GPX (default JSON)"},
+         {"encode", 'e', POPT_ARG_NONE, &doencode, 0, "Convert JSON to binary, and report sizes and times"},
+         {"check", 'c', POPT_ARG_NONE, &check, 0, "Check binary converts back to the same JSON (with --encode)"},
+         {"no-write", 'n', POPT_ARG_NONE, &nowrite, 0, "Do not write binary (with --encode)"},
+         {"gzip", 'z', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &gzip, 0, "Compression level to report (with --encode, 0 for none)", "N"},
+         {"repeat", 'r', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &repeat, 0, "Runs for timing (with --encode)", "N"},
+         {"debug", 'v', POPT_ARG_NONE, &debug, 0, "Debug"},
+         POPT_AUTOHELP {}
+      };
+
+      optCon = poptGetContext (NULL, argc, argv, optionsTable, 0);
+      poptSetOtherOptionHelp (optCon, "[files]");
+
+      int c;
+      if ((c = poptGetNextOpt (optCon)) < -1)
+         errx (1, "%s: %s\n", poptBadOption (optCon, POPT_BADOPTION_NOALIAS), poptStrerror (c));
+
+      if (!poptPeekArg (optCon))
+      {
+         poptPrintUsage (optCon, stderr, 0);
+         return -1;
+      }
+      if (repeat < 1)
+         errx (1, "Bad --repeat");
+      if (gzip < 0 || gzip > 9)
+         errx (1, "Bad --gzip");
+   }
+   const char *fn;
+   while ((fn = poptGetArg (optCon)))
+   {
+      const char *e = strrchr (fn, '.');
+      if (!e)
+         e = fn + strlen (fn);
+      char *ofn = NULL;
+      if (outfile)
+         ofn = strdup (outfile);
+      else
+         asprintf (&ofn, "%.*s.%s", (int) (e - fn), fn, doencode ? LOGBIN_EXT : gpx ? "gpx" : "json");
+      if (doencode)
+         encode (fn, nowrite ? NULL : ofn);
+      else
+      {
+         FILE *i = fopen (fn, "r");
+         if (!i)
+            err (1, "Cannot open %s", fn);
+         FILE *o = fopen (ofn, "w");
+         if (!o)
+            err (1, "Cannot open %s", ofn);
+         int r = logconv (i, o, gpx ? LOGCONV_GPX : LOGCONV_JSON);
+         if (r < 0)
+            warnx ("Not a binary log %s", fn);
+         else if (r)
+            warnx ("No end record %s, end added", fn);
+         fclose (o);
+         fclose (i);
+      }
+      free (ofn);
+   }
+   poptFreeContext (optCon);
+   return 0;
+}
@@ -10,110 +10,14 @@
 #include <err.h>
 #include <ajl.h>
 #include <math.h>
+#include "loggpx.h"
+#include "jsonfix.h"
+#include "rdp.h"
 
 int debug = 0;
-double rdp = 0;
+double rdpdist = 0;
 double timescale = 10.0;
 
-double
-p (j_t P, const char *tag)
-{
-   if (!P)
-      return 0;
-   const char *v = j_get (P, tag);
-   if (!v)
-      return 0;
-   return strtod (v, NULL);
-}
-
-double
-dist2 (j_t A, j_t B)
-{                               // Distance between two fixes
-   j_t a = j_find (A, "ecef");
-   j_t b = j_find (B, "ecef");
-   double X = p (a, "x") - p (b, "x");
-   double Y = p (a, "y") - p (b, "y");
-   double Z = p (a, "z") - p (b, "z");
-   double T = 0;
-   if (timescale)
-      T = (p (a, "t") - p (b, "t")) / timescale;;
-   return X * X + Y * Y + Z * Z + T * T;
-}
-
-j_t
-findmax (j_t A, j_t B, double *dsqp)
-{
-   if (dsqp)
-      *dsqp = 0;
-   if (!A || !B || A == B || j_next (A) == B)
-      return NULL;
-   double b2 = dist2 (B, A);
-   j_t m = NULL;
-   double best = 0;
-   for (j_t C = j_next (A); C && C != B; C = j_next (C))
-   {
-      double h2 = 0;
-      double a2 = dist2 (A, C),
-         c2 = 0;
-      if (b2 == 0.0)
-         h2 = a2;               // A/B same, so distance from A
-      else
-      {
-         c2 = dist2 (C, B);
-         if (c2 - b2 >= a2)
-            h2 = a2;            // Off end of A
-         else if (a2 - b2 >= c2)
-            h2 = c2;            // Off end of B
-         else
-            h2 = (4 * a2 * b2 - (a2 + b2 - c2) * (a2 + b2 - c2)) / (b2 * 4);    // see https://www.revk.uk/2024/01/distance-of-point-to-lie-in-four.html
-      }
-      //if (debug) warnx ("a=%lf b=%lf c=%lf h=%lf", sqrt(a2), sqrt(b2), sqrt(c2), sqrt(h2));
-      if (m && h2 <= best)
-         continue;              // Not bigger
-      best = h2;
-      m = C;
-   }
-   if (dsqp)
-      *dsqp = best;
-   return m;
-}
-
-void
-dordp (j_t j, j_t B)
-{
-   j_t A = NULL;
-   j_t L = NULL;
-   while (j && j != B)
-   {
-      if (!j_find (j, "ecef"))
-         j_store_true (j, "delete");
-      else
-      {
-         if (!A)
-            A = j;
-         L = j;
-      }
-      j = j_next (j);
-   }
-   B = L;
-   if (!A || A == B || j_next (A) == B)
-      return;
-   double dsq = 0;
-   j_t M = findmax (A, B, &dsq);
-   if (debug)
-      warnx ("%s-%s-%s %lf", j_get (A, "seq"), j_get (M, "seq"), j_get (B, "seq"), sqrt (dsq));
-   if (dsq >= rdp * rdp)
-   {
-      dordp (A, M);
-      dordp (M, B);
-   } else
-   {
-      while ((A = j_next (A)) && A != B)
-         if (!j_find (A, "waypoint"))
-            j_store_true (A, "delete");
-   }
-}
-
 int
 main (int argc, const char *argv[])
 {
@@ -122,7 +26,7 @@ main (int argc, const char *argv[])
    {                            // POPT
       const struct poptOption optionsTable[] = {
          {"out-file", 'o', POPT_ARG_STRING, &outfile, 0, "Single outfile file", "filename"},
-         {"rdp", 0, POPT_ARG_DOUBLE, &rdp, 0, "Ramer-Douglas-Peucker", "metres"},
+         {"rdp", 0, POPT_ARG_DOUBLE, &rdpdist, 0, "Ramer-Douglas-Peucker", "metres"},
          {"timescale", 0, POPT_ARG_DOUBLE | POPT_ARGFLAG_SHOW_DEFAULT, &timescale, 0, "Scale for metres to seconds", "M"},
          {"debug", 'v', POPT_ARG_NONE, &debug, 0, "Debug"},
          POPT_AUTOHELP {}
@@ -144,14 +48,13 @@ main (int argc, const char *argv[])
    FILE *o = NULL;
    void xml_start (const char *id)
    {
-      fprintf (o, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"        //
-               "<gpx version=\"1.0\">\n");
+      fprintf (o, LOGGPX_HEAD);
       if (id)
-         fprintf (o, "<metadata><name>%s</name></metadata>\n", id);
+         fprintf (o, "<metadata><name>%s</name></metadata>\r\n", id);
    }
    void xml_end (void)
    {
-      fprintf (o, "</gpx>\n");
+      fprintf (o, LOGGPX_END);
    }
    if (outfile)
    {
@@ -191,41 +94,40 @@ main (int argc, const char *argv[])
             const char *start = j_get (j, "start.ts");
             if (!outfile)
                xml_start (id);
-            fprintf (o, "<trk><name>%s %s</name><trkseg>\n", name ? : id, start ? : filename);
-            if (rdp)
-               dordp (j_first (g), NULL);
+            fprintf (o, "<trk><name>%s %s</name><trkseg>\r\n", name ? : id, start ? : filename);
+            int n = 0;
             for (j_t e = j_first (g); e; e = j_next (e))
+               n++;
+            struct
             {
-               if (j_get (e, "delete"))
-                  continue;
-               const char *ts = j_get (e, "ts");
-               const char *lat = j_get (e, "lat");
-               const char *lon = j_get (e, "lon");
-               if (!ts || !lat || !lon)
+               fix_t f;
+               uint32_t fields;
+               uint8_t errors;
+               uint8_t ts:1;
+            } *fixes = calloc (n ? : 1, sizeof (*fixes));
+            if (!fixes)
+               errx (1, "malloc");
+            n = 0;
+            for (j_t e = j_first (g); e; e = j_next (e), n++)
+            {
+               fixes[n].fields = json_fix (e, &fixes[n].f, &fixes[n].errors);
+               fixes[n].ts = (j_get (e, "ts") ? 1 : 0);
+               if (n)
+                  fixes[n - 1].f.next = &fixes[n].f;
+            }
+            if (rdpdist && n)
+               rdp (&fixes[0].f, NULL, rdpdist, timescale);
+            for (int i = 0; i < n; i++)
+            {
+               if (fixes[i].f.deleted || !fixes[i].ts)
                   continue;
-               const char *alt = j_get (e, "alt");
-               const char *hdop = j_get (e, "hdop");
-               const char *vdop = j_get (e, "vdop");
-               const char *pdop = j_get (e, "pdop");
-               int sats = atoi (j_get (e, "sats.used") ? : "");
-               int fix = atoi (j_get (e, "fixmode") ? : "");
-               fprintf (o, "<trkpt lat=\"%s\" lon=\"%s\">", lat, lon);
-               if (alt)
-                  fprintf (o, "<ele>%s</ele>", alt);
-               fprintf (o, "<time>%s</time>", ts);
-               if (fix >= 1)
-                  fprintf (o, "<fix>%s</fix>", fix == 1 ? "none" : fix == 2 ? "2d" : "3d");
-               if (sats)
-                  fprintf (o, "<sat>%d</sat>", sats);
-               if (hdop)
-                  fprintf (o, "<hdop>%s</hdop>", hdop);
-               if (vdop)
-                  fprintf (o, "<vdop>%s</vdop>", vdop);
-               if (pdop)
-                  fprintf (o, "<pdop>%s</pdop>", pdop);
-               fprintf (o, "</trkpt>\n");
+               char l[LOGGPX_MAX];
+               fwrite (l, loggpx_fix (l, sizeof (l), &fixes[i].f, fixes[i].fields, 0, fixes[i].errors), 1, o);
             }
-            fprintf (o, "</trkseg></trk>\n");
+            free (fixes);
+            fprintf (o, LOGGPX_TRKEND);
+            if (!outfile)
+               xml_end ();
             if (!outfile)
                fclose (o);
             free (ofn);
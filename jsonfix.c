@@ -0,0 +1,157 @@
+// JSON log fix to fix_t, for host tools
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include "jsonfix.h"
+#include "logjson.h"
+
+int64_t
+parse (const char *p, uint8_t places)
+{                               // As on device, fixed point
+   if (!p || !*p)
+      return 0;
+   const char *s = p;
+   if (*p == '-')
+      p++;
+   int64_t v = 0;
+   while (*p && isdigit (*p))
+      v = v * 10 + *p++ - '0';
+   if (*p == '.')
+   {
+      p++;
+      while (places && *p && isdigit (*p))
+      {
+         v = v * 10 + *p++ - '0';
+         places--;
+      }
+   }
+   while (places)
+   {
+      v *= 10;
+      places--;
+   }
+   if (*s == '-')
+      v = 0 - v;
+   return v;
+}
+
+uint32_t
+json_fix (j_t g, fix_t * f, uint8_t * errors)
+{                               // Fix as logged
+   uint32_t fields = 0;
+   memset (f, 0, sizeof (*f));
+   if (errors)
+      *errors = atoi (j_get (g, "errors") ? : "");
+   f->alt = f->und = f->hdop = f->hepe = f->vepe = f->dsq = NAN;
+   f->slow.pdop = f->slow.vdop = f->slow.speed = f->slow.course = NAN;
+   const char *v;
+   if ((v = j_get (g, "seq")))
+   {
+      f->seq = atoi (v);
+      fields |= LOGBIN_SEQ;
+   }
+   if ((v = j_get (g, "ecef.t")))
+   {
+      f->ecef.t = parse (v, 6);
+      f->sett = 1;
+   } else if ((v = j_get (g, "ts")))
+   {                            // No ECEF, so time from timestamp
+      struct tm t = { 0 };
+      const char *p = strptime (v, "%Y-%m-%dT%H:%M:%S", &t);
+      if (p)
+      {
+         f->ecef.t = (int64_t) timegm (&t) * 1000000LL + (*p == '.' ? parse (p, 6) : 0);
+         f->sett = 1;
+      }
+   }
+   if (j_find (g, "sats"))
+      fields |= LOGBIN_SATS;
+   for (int s = 0; s < SYSTEMS; s++)
+   {
+      char tag[20];
+      sprintf (tag, "sats.%s", system_name[s]);
+      f->slow.gsa[s] = atoi (j_get (g, tag) ? : "");
+   }
+   f->sats = atoi (j_get (g, "sats.used") ? : "");
+   f->slow.fixmode = atoi (j_get (g, "fixmode") ? : "");
+   if ((v = j_get (g, "lat")))
+   {
+      f->lat = strtod (v, NULL);
+      f->lon = strtod (j_get (g, "lon") ? : "", NULL);
+      f->quality = atoi (j_get (g, "quality") ? : "");
+      f->setlla = 1;
+      fields |= LOGBIN_LLA;
+   }
+   if ((v = j_get (g, "alt")))
+      f->alt = strtof (v, NULL);
+   if ((v = j_get (g, "und")))
+   {
+      f->und = strtof (v, NULL);
+      fields |= LOGBIN_UND;
+   }
+   if ((v = j_get (g, "hepe")))
+      f->hepe = strtof (v, NULL);
+   if ((v = j_get (g, "vepe")))
+      f->vepe = strtof (v, NULL);
+   if (!isnan (f->hepe) || !isnan (f->vepe))
+   {
+      f->setepe = 1;
+      fields |= LOGBIN_EPE;
+   }
+   if ((v = j_get (g, "hdop")))
+      f->hdop = strtof (v, NULL);
+   if ((v = j_get (g, "pdop")))
+      f->slow.pdop = strtof (v, NULL);
+   if ((v = j_get (g, "vdop")))
+      f->slow.vdop = strtof (v, NULL);
+   if (!isnan (f->hdop) || !isnan (f->slow.pdop) || !isnan (f->slow.vdop))
+      fields |= LOGBIN_DOP;
+   if ((v = j_get (g, "speed")))
+   {
+      f->slow.speed = strtof (v, NULL);
+      fields |= LOGBIN_CS;
+   } else if ((v = j_get (g, "mph")))
+      f->slow.speed = strtof (v, NULL) * 1.609344;
+   if (j_find (g, "mph"))
+      fields |= LOGBIN_MPH;
+   if ((v = j_get (g, "course")))
+      f->slow.course = strtof (v, NULL);
+   if ((v = j_get (g, "ecef.x")))
+   {
+      f->ecef.x = parse (v, 6);
+      f->ecef.y = parse (j_get (g, "ecef.y"), 6);
+      f->ecef.z = parse (j_get (g, "ecef.z"), 6);
+      f->setecef = 1;
+      fields |= LOGBIN_ECEF;
+   }
+   if ((v = j_get (g, "acc.x")))
+   {
+      f->acc.x = strtof (v, NULL);
+      f->acc.y = strtof (j_get (g, "acc.y") ? : "", NULL);
+      f->acc.z = strtof (j_get (g, "acc.z") ? : "", NULL);
+      f->accmove = (j_find (g, "acc.move") ? 1 : 0);
+      f->acccrash = (j_find (g, "acc.crash") ? 1 : 0);
+      f->setacc = 1;
+      fields |= LOGBIN_ACC;
+   }
+   if ((v = j_get (g, "dsq")))
+   {
+      f->dsq = strtof (v, NULL);
+      fields |= LOGBIN_DSQ;
+   }
+   if ((v = j_get (g, "odo")))
+   {
+      f->odo = parse (v, 2);
+      f->setodo = 1;
+      fields |= LOGBIN_ODO;
+   }
+   if (j_find (g, "home"))
+      f->home = 1;
+   if (j_find (g, "waypoint"))
+      f->waypoint = 1;
+   return fields;
+}
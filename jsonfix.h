@@ -0,0 +1,7 @@
+// JSON log fix to fix_t, for host tools
+
+#include <ajl.h>
+#include "fix.h"
+
+int64_t parse (const char *p, uint8_t places);  // Fixed point, as on device
+uint32_t json_fix (j_t g, fix_t * f, uint8_t * errors); // Fix from JSON log gps entry, return fields logged (LOGBIN_*)
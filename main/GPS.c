@@ -20,19 +20,26 @@ __attribute__((unused))
 #include <driver/sdmmc_host.h>
 #include <driver/i2c.h>
 #include "email.h"
+#include "pack.h"
+#include "logbin.h"
+#include "logz.h"
+#include "loggpx.h"
+#include "logjson.h"
+#include "sdlog.h"
+#include "lograw.h"
+#include "logconv.h"
+#include "sdread.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/base64.h"
 
 #ifdef	CONFIG_FATFS_LFN_NONE
 #error Need long file names
 #endif
 
 //#define       POSTCODEDEBUG   // Debug for postcode lookup
-#define	ODOBASE	10000000000     // cm
-
-#define	SYSTEMS	3
 
      const char system_code[SYSTEMS] = { 'P', 'L', 'A' };
 const char system_colour[SYSTEMS] = { 'G', 'Y', 'C' };
-const char *const system_name[SYSTEMS] = { "NAVSTAR", "GLONASS", "GALILEO" };
 
 #define	I2CPORT	0
 #define	BATSCALE	3       // Pot divide on battery voltage (ADC1)
@@ -51,6 +58,8 @@ httpd_handle_t webserver = NULL;
 const char sd_mount[] = "/sd";
 const char postcodefile[] = "/sd/POSTCODE.DAT";
 const char odometer[] = "/sd/ODOMETER.TXT";
+const char openlog[] = "/sd/OPENLOG.TXT";   // Log file being written, if checkpointing
+const char rawlog[] = "/sd/JOURNEY.RAW";    // Live journey, if sd.raw set
 led_strip_handle_t strip = NULL;
 SemaphoreHandle_t cmd_mutex = NULL;
 SemaphoreHandle_t ack_semaphore = NULL;
@@ -60,6 +69,8 @@ uint8_t gpserrorcount = 0;      // running count
 uint8_t gpserrors = 0;          // last count
 uint8_t vtgcount = 0;           // Count of stopped/moving
 uint8_t upload = 0;             // File upload progress
+uint16_t fixms = 0;             // Current fix rate (ms)
+uint16_t fixwant = 0;           // Wanted fix rate (ms), adaptive
 char rgbsd = 'K';
 const char *cardstatus = NULL;
 int32_t pos[3] = { 0 };         // last x/y/z
@@ -75,7 +86,9 @@ RTC_NOINIT_ATTR uint64_t csvtime;
 float adc[3];                   // ADCs
 
 uint64_t sdsize = 0,            // SD card data
-   sdfree = 0;
+   sdfree = 0,
+   sdfreemount = 0;             // Free when mounted, for trend
+uint32_t sdmountus = 0;         // Time to mount
 
 struct
 {
@@ -101,63 +114,7 @@ struct
    uint8_t lastwaypoint:1;      // Waypoint continuing  // Waypoint continuing
 } volatile b = { 0 };
 
-typedef struct slow_s slow_t;
-struct slow_s
-{                               // Slow updated data
-   uint8_t gsv[SYSTEMS];        // Sats in view
-   uint8_t gsa[SYSTEMS];        // Sats active
-   uint8_t fixmode;             // Fix mode from slow update, 1=none, 2=2d, 3=3d
-   float course;
-   float speed;
-   float hdop;                  // Slow hdop
-   float pdop;
-   float vdop;
-} status = { 0 };
-
-typedef struct fix_s fix_t;
-struct fix_s
-{                               // each fix
-   fix_t *next;                 // Next in queue
-   uint32_t seq;                // Simple sequence number
-   struct
-   {                            // Earth centred Earth fixed, used for packing, etc, and time stamp (us)
-      int64_t x,
-        y,
-        z,
-        t;
-   } ecef;
-   slow_t slow;
-   uint64_t odo;                // Odometer
-   double lat,
-     lon;
-   float alt;
-   float und;
-   float hdop;
-   float hepe;                  // Estimated position error
-   float vepe;
-   float dsq;                   // Square of deviation from line from packing
-   struct acc
-   {                            // Acc data
-      float x,
-        y,
-        z;
-   } acc;
-   uint8_t quality;             // Fix quality (0=none, 1=GPS, 2=SBAS)
-   uint8_t sats;                // Sats used for fix
-   uint8_t accmove:1;           // Acc G level for move
-   uint8_t acccrash:1;          // Acc G level for crascrash
-   uint8_t waypoint:1;          // Log a waypoint
-   uint8_t home:1;              // This pos is at home
-   uint8_t corner:1;            // Corner point for packing
-   uint8_t deleted:1;           // Deleted by packing
-   uint8_t sett:1;              // Fields set
-   uint8_t setsat:1;
-   uint8_t setecef:1;
-   uint8_t setlla:1;
-   uint8_t setepe:1;
-   uint8_t setodo:1;
-   uint8_t setacc:1;
-};
+slow_t status = { 0 };
 
 typedef struct fixq_s fixq_t;
 struct fixq_s
@@ -172,6 +129,9 @@ fixq_t fixpack = { 0 };         // Queue to pack
 fixq_t fixsd = { 0 };           // Queue to record to SD
 fixq_t fixfree = { 0 };         // Queue of free
 
+pack_t pack = { 0 };            // Packing state and stats
+volatile uint8_t packreset = 0; // Set to have pack_task clear pack.stats, as only it updates them
+
 void power_shutdown (void);
 
 int64_t
@@ -205,28 +165,17 @@ parse (const char *p, uint8_t places)
 }
 
 char *
-getts (uint64_t when, char fn)
-{
-   struct tm t;
-   time_t now = when / 1000000LL;
-   gmtime_r (&now, &t);
-   if (t.tm_year < 100)
+getts (char *buf, uint64_t when, char fn)
+{                               // Timestamp in buf (at least 30 bytes), NULL (and buf empty) if not valid time
+   if (!logjson_ts (buf, when))
       return NULL;
-   uint32_t ms = when / 1000LL % 1000LL;
-   char temp[50],
-    *p = temp;
-   p += sprintf (p, "%04d-%02d-%02dT%02d:%02d:%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
-   if (ms)
-      p += sprintf (p, ".%03ld", ms);
-   *p++ = 'Z';
-   *p = 0;
    if (fn)
    {
-      for (char *p = temp; *p; p++)
+      for (char *p = buf; *p; p++)
          if (*p == ':' || *p == '.')
             *p = fn;
    }
-   return strdup (temp);
+   return buf;
 }
 
 #define	POSTCODEDATMAGIX	20240122
@@ -760,6 +709,89 @@ acc_get (fix_t * f)
    adc[2] = (1.2 + 0.4 * (float) ((int16_t) (data[4] + (data[5] << 8)) >> 6) / 1024);   // Temp
 }
 
+void
+gps_adapt (fix_t * f)
+{                               // Adaptive fix rate - fast when turning or accelerating, slow when straight and steady
+   static int64_t x = 0,
+      y = 0,
+      z = 0,
+      t = 0;                    // Last fix used (ECEF)
+   static float vx = 0,
+      vy = 0,
+      vz = 0;                   // Last velocity (m/s)
+   static int64_t active = 0;   // Last time turning or accelerating
+   static int64_t steady = 0;   // Last time not straight and steady
+   static float ax = 0,
+      ay = 0,
+      az = 0;                   // Accelerometer total since last fix used
+   static int an = 0;           // Accelerometer samples since last fix used
+   if (!gpsadapt || !b.moving || !f->sett || !f->setecef)
+   {                            // Normal fix rate
+      t = 0;
+      fixwant = gpsfixms;
+      return;
+   }
+   if (f->setacc)
+   {
+      ax += f->acc.x;
+      ay += f->acc.y;
+      az += f->acc.z;
+      an++;
+   }
+   if (t && f->ecef.t - t < 1000000LL)
+      return;                   // At least a second apart, else position noise swamps acceleration
+   if (!t || f->ecef.t - t > 30000000LL)
+   {                            // Start
+      x = f->ecef.x;
+      y = f->ecef.y;
+      z = f->ecef.z;
+      t = active = steady = f->ecef.t;
+      vx = vy = vz = 0;
+      ax = ay = az = an = 0;
+      return;
+   }
+   float dt = (float) (f->ecef.t - t) / 1000000.0;
+   float nx = (float) (f->ecef.x - x) / 1000000.0 / dt;
+   float ny = (float) (f->ecef.y - y) / 1000000.0 / dt;
+   float nz = (float) (f->ecef.z - z) / 1000000.0 / dt;
+   float v0 = sqrtf (vx * vx + vy * vy + vz * vz);
+   float v1 = sqrtf (nx * nx + ny * ny + nz * nz);
+   float turn = 0;              // degrees/s
+   float accel = 0;             // m/s/s
+   if (v0 > 1 && v1 > 1 && (isnan (f->hepe) || v1 * dt > f->hepe))
+   {                            // Moving enough to be meaningful
+      float c = (vx * nx + vy * ny + vz * nz) / (v0 * v1);
+      turn = acosf (c > 1 ? 1 : c < -1 ? -1 : c) * 180.0 / M_PI / dt;
+      accel = sqrtf ((nx - vx) * (nx - vx) + (ny - vy) * (ny - vy) + (nz - vz) * (nz - vz)) / dt;
+   }
+   if (an >= 2)
+   {                            // Accelerometer, not knowing orientation, so difference from 1g, of the mean over the same time as the ECEF velocity, so one jolt (pothole, kerb, door) does not count
+      float g = fabsf (sqrtf (ax * ax + ay * ay + az * az) / an - 1) * 9.80665;
+      if (g > accel)
+         accel = g;
+   }
+   ax = ay = az = an = 0;
+   x = f->ecef.x;
+   y = f->ecef.y;
+   z = f->ecef.z;
+   t = f->ecef.t;
+   vx = nx;
+   vy = ny;
+   vz = nz;
+   if ((gpsturn && turn >= gpsturn) || (gpsaccel && accel * gpsaccel_scale >= gpsaccel))
+   {                            // Turning or accelerating
+      active = steady = t;
+      fixwant = gpsfast;
+      return;
+   }
+   if (v1 > 1 && ((gpsturn && turn * 4 >= gpsturn) || (gpsaccel && accel * gpsaccel_scale * 4 >= gpsaccel)))
+      steady = t;               // Not straight and steady, but not slow either
+   if (t - steady >= 30000000LL)
+      fixwant = gpsslow;
+   else if (t - active >= 10000000LL)
+      fixwant = gpsfixms;
+}
+
 void
 gps_init (void)
 {                               // Set up GPS
@@ -872,6 +904,7 @@ nmea (char *s)
       if (fix)
       {
          fix->slow = status;
+         gps_adapt (fix);
          fix = fixadd (&fixlog, fix);
       }
       if (tod)
@@ -967,8 +1000,8 @@ nmea (char *s)
    }
    if (!strcmp (f[0], "PMTK500") && n >= 2)
    {                            // Fix rate
-      if (atoi (f[1]) != gpsfixms)
-         gps_cmd ("$PMTK220,%d", gpsfixms);
+      if (atoi (f[1]) != fixms)
+         gps_cmd ("$PMTK220,%d", fixms);
       return;
    }
    if (!strcmp (f[0], "PMTK705") && n >= 2)
@@ -978,17 +1011,17 @@ nmea (char *s)
       unsigned int rates[19] = { 0 };
       //rates[0]=0;     // GLL
       //rates[1]=0;     // RMC
-      rates[2] = (VTGRATE * 1000 / gpsfixms ? : 1);     // VTG
+      rates[2] = (VTGRATE * 1000 / fixms ? : 1);     // VTG
       rates[3] = 1;             // GGA every sample
-      rates[4] = (GSARATE * 1000 / gpsfixms ? : 1);     // GSA
-      rates[5] = (GSVRATE * 1000 / gpsfixms ? : 1);     // GSV
+      rates[4] = (GSARATE * 1000 / fixms ? : 1);     // GSA
+      rates[5] = (GSVRATE * 1000 / fixms ? : 1);     // GSV
       //rates[6]=0; // GRS
       //rates[7]=0; // GST
       //rates[13]=0; // MALM
       //rates[14]=0; // MEPH
       //rates[15]=0; // MDGP
       //rates[16]=0; // MDBG
-      rates[17] = (ZDARATE * 1000 / gpsfixms ? : 1);    // ZDA
+      rates[17] = (ZDARATE * 1000 / fixms ? : 1);    // ZDA
       int q;
       for (q = 0; q < sizeof (rates) / sizeof (*rates) && rates[q] == (1 + q < n ? atoi (f[1 + q]) : 0); q++);
       if (q < sizeof (rates) / sizeof (*rates)) // Set message rates
@@ -1145,7 +1178,7 @@ nmea_task (void *z)
             if (++rate >= sizeof (rates) / sizeof (*rates))
                rate = 0;
             gps_connect (rates[rate]);
-            timeout = esp_timer_get_time () + 2000000LL + gpsfixms * 1000LL;
+            timeout = esp_timer_get_time () + 2000000LL + fixms * 1000LL;
             nmea_timeout (uptime ());
          }
          continue;
@@ -1170,7 +1203,7 @@ nmea_task (void *z)
                gpserrorcount++;
             else
             {                   // Process line
-               timeout = esp_timer_get_time () + 60000000LL + gpsfixms * 1000LL;
+               timeout = esp_timer_get_time () + 60000000LL + fixms * 1000LL;
                l[-3] = 0;
                nmea ((char *) p);
             }
@@ -1192,115 +1225,20 @@ nmea_task (void *z)
    vTaskDelete (NULL);
 }
 
-jo_t
-log_line (fix_t * f)
-{                               // generate log line
-   jo_t j = jo_object_alloc ();
-   if (f->sett)
-   {
-      char *ts = getts (f->ecef.t, 0);
-      if (ts)
-         jo_stringf (j, "ts", ts);
-      free (ts);
-   }
-   if (logseq)
-      jo_int (j, "seq", f->seq);
-   if (logsats && f->sats + f->slow.gsa[0] + f->slow.gsa[1] + f->slow.gsa[2])
-   {
-      jo_object (j, "sats");
-      for (int s = 0; s < SYSTEMS; s++)
-         if (f->slow.gsa[s])
-            jo_int (j, system_name[s], f->slow.gsa[s]);
-      if (f->sats)
-         jo_int (j, "used", f->sats);
-      jo_close (j);
-   }
-   if (f->slow.fixmode)
-      jo_int (j, "fixmode", f->slow.fixmode);
-   if (loglla && f->setlla && f->quality)
-   {
-      jo_litf (j, "lat", "%.8lf", f->lat);
-      jo_litf (j, "lon", "%.8lf", f->lon);
-      if (f->slow.fixmode >= 3 && !isnan (f->alt))
-         jo_litf (j, "alt", "%.2f", f->alt);
-      jo_int (j, "quality", f->quality);
-   }
-   if (logund && f->slow.fixmode >= 3 && !isnan (f->und))
-      jo_litf (j, "und", "%.2f", f->und);
-   if (logepe && f->setepe && f->slow.fixmode >= 1)
-   {
-      if (f->hepe > 0)
-         jo_litf (j, "hepe", "%.2f", f->hepe);
-      if (f->vepe > 0 && f->slow.fixmode >= 3)
-         jo_litf (j, "vepe", "%.2f", f->vepe);
-   }
-   if (logdop)
-   {
-      if (!isnan (f->hdop) && f->hdop)
-         jo_litf (j, "hdop", "%.1f", f->hdop);
-      if (!isnan (f->slow.pdop) && f->slow.pdop)
-         jo_litf (j, "pdop", "%.1f", f->slow.pdop);
-      if (!isnan (f->slow.vdop) && f->slow.vdop && f->slow.fixmode >= 3)
-         jo_litf (j, "vdop", "%.1f", f->slow.vdop);
-   }
-   if (logcs && f->quality && !isnan (f->slow.speed) && f->slow.speed != 0)
-   {
-      jo_litf (j, "speed", "%.2f", f->slow.speed);
-      if (!isnan (f->slow.course))
-         jo_litf (j, "course", "%.2f", f->slow.course);
-   }
-   if (logmph && f->quality && !isnan (f->slow.speed) && f->slow.speed != 0)
-      jo_litf (j, "mph", "%.2f", f->slow.speed / 1.609344);
-   if (f->setecef && logecef)
-   {
-      void o (const char *t, int64_t v)
-      {
-         char *s = "";
-         if (v < 0)
-         {
-            v = 0 - v;
-            s = "-";
-         }
-         uint32_t us = v % 1000000LL;
-         if (us)
-            jo_litf (j, t, "%s%lld.%06lld", s, v / 1000000LL, v % 1000000LL);
-         else
-            jo_litf (j, t, "%s%lld", s, v / 1000000LL);
-      }
-      jo_object (j, "ecef");
-      o ("x", f->ecef.x);
-      o ("y", f->ecef.y);
-      o ("z", f->ecef.z);
-      if (f->sett)
-         o ("t", f->ecef.t);
-      jo_close (j);
-   }
-   if (f->setacc && logacc)
-   {
-      jo_object (j, "acc");
-      jo_litf (j, "x", "%.3f", f->acc.x);
-      jo_litf (j, "y", "%.3f", f->acc.y);
-      jo_litf (j, "z", "%.3f", f->acc.z);
-      if (f->accmove)
-         jo_bool (j, "move", 1);
-      if (f->acccrash)
-         jo_bool (j, "crash", 1);
-      jo_close (j);
-   }
-   if (logdsq && !isnan (f->dsq))
-      jo_litf (j, "dsq", "%f", f->dsq);
-   if (logodo && f->setodo && f->odo >= ODOBASE)
-      jo_litf (j, "odo", "%lld.%02lld", (f->odo + odoadjust) / 100LL, (f->odo + odoadjust) % 100LL);
-   if (gpserrors)
-   {
-      jo_int (j, "errors", gpserrors);
-      gpserrors = 0;
-   }
-   if (f->home && f->setecef)
-      jo_bool (j, "home", 1);
-   if (f->waypoint)
-      jo_bool (j, "waypoint", 1);
-   return j;
+uint32_t
+log_fields (void)
+{                               // Log settings as fields for binary log
+   return (logseq ? LOGBIN_SEQ : 0) | (logsats ? LOGBIN_SATS : 0) | (loglla ? LOGBIN_LLA : 0) | (logund ? LOGBIN_UND : 0) |
+      (logepe ? LOGBIN_EPE : 0) | (logdop ? LOGBIN_DOP : 0) | (logcs ? LOGBIN_CS : 0) | (logmph ? LOGBIN_MPH : 0) |
+      (logecef ? LOGBIN_ECEF : 0) | (logacc ? LOGBIN_ACC : 0) | (logdsq ? LOGBIN_DSQ : 0) | (logodo ? LOGBIN_ODO : 0);
+}
+
+int
+log_line (char *buf, int size, fix_t * f)
+{                               // generate log line in buf, no heap use
+   int len = logjson_fix (buf, size, f, log_fields (), odoadjust, gpserrors);
+   gpserrors = 0;
+   return len;
 }
 
 void
@@ -1318,7 +1256,10 @@ log_task (void *z)
          continue;
       if (logmqtt)
       {
-         jo_t j = log_line (f);
+         char line[LOGJSON_MAX];
+         log_line (line, sizeof (line), f);
+         jo_t j = jo_create_alloc ();
+         jo_litf (j, NULL, "%s", line);
          revk_info ("GPS", &j);
       }
       // Pass on - if packing, and TS and ECEF, to packing, else if packing and no TS or ECEF then drop as packing does not do those. Else direct to SD
@@ -1327,110 +1268,776 @@ log_task (void *z)
    vTaskDelete (NULL);
 }
 
-float
-dist2 (fix_t * A, fix_t * B)
-{                               // Distance between two fixes
-   float X = ((float) (A->ecef.x - B->ecef.x)) / 1000000.0;
-   float Y = ((float) (A->ecef.y - B->ecef.y)) / 1000000.0;
-   float Z = ((float) (A->ecef.z - B->ecef.z)) / 1000000.0;
-   float T = 0;
-   if (packtime)
-      T = ((float) ((A->ecef.t - B->ecef.t) * packdist / packtime)) / 1000000.0;
-   return X * X + Y * Y + Z * Z + T * T;
-}
-
-fix_t *
-findmax (fix_t * A, fix_t * B, float *dsqp)
-{
-   if (dsqp)
-      *dsqp = 0;
-   if (!A || !B || A == B || A->next == B)
-      return NULL;
-   float b2 = dist2 (B, A);
-   fix_t *m = NULL;
-   float best = 0;
-   for (fix_t * C = A->next; C && C != B; C = C->next)
-   {
-      float h2 = 0;
-      float a2 = dist2 (A, C),
-         c2 = 0;
-      if (b2 == 0.0)
-         h2 = a2;               // A/B same, so distance from A
-      else
-      {
-         c2 = dist2 (C, B);
-         if (c2 - b2 >= a2)
-            h2 = a2;            // Off end of A
-         else if (a2 - b2 >= c2)
-            h2 = c2;            // Off end of B
-         else
-            h2 = (4 * a2 * b2 - (a2 + b2 - c2) * (a2 + b2 - c2)) / (b2 * 4);    // see https://www.revk.uk/2024/01/distance-of-point-to-lie-in-four.html
-      }
-      C->dsq = h2;              // Before EPE adjust
-      if (m && h2 <= best)
-         continue;              // Not bigger
-      best = h2;
-      m = C;
-   }
-   if (dsqp)
-      *dsqp = best;
-   return m;
-}
-
 void
 pack_task (void *z)
 {                               // Packing - only gets data with ECEF and time set
    uint32_t packtry = packmin;
    while (!b.die)
    {
+      if (packreset)
+      {                         // New journey
+         memset (&pack.stats, 0, sizeof (pack.stats));
+         packreset = 0;
+      }
       if (fixpack.count < 2 || (b.moving && fixpack.count < packtry))
       {                         // Wait
          usleep (100000);
          continue;
       }
-      fix_t *A = fixpack.base;
-      fix_t *B = fixpack.last;
-      float dsq = 0;
-      float cutoff = (float) packdist * (float) packdist;
-      fix_t *M = findmax (A, B, &dsq);
-      fix_t *E = M ? : B;
-      if (dsq < cutoff && b.moving && fixpack.count < packmax)
+      if (fixpack.count > pack.stats.peak)
+         pack.stats.peak = fixpack.count;
+      if (pack.dist != packdist || pack.time != packtime || pack.sed != packsed)
+      {                         // Settings changed, bound from last check was for the old ones
+         pack.dist = packdist;
+         pack.time = packtime;
+         pack.sed = packsed;
+         pack.P = NULL;
+      }
+      int64_t start = esp_timer_get_time ();
+      fix_t *E = pack_step (&pack, fixpack.base, fixpack.last, b.moving && fixpack.count < packmax);
+      pack.stats.us += esp_timer_get_time () - start;
+      if (!E)
       {                         // wait for more
          packtry += packmin;
          continue;
       }
-      A->corner = 1;
       packtry = packmin;
-      if (dsq < cutoff)
-         for (fix_t * X = A->next; X && X != B; X = X->next)
-            X->deleted = 1;     // All within cutoff
-      else
-         while (A && M)
-         {                      // Check A to M - recursively
-            M->corner = 1;
-            B = M;
-            M = findmax (A, B, &dsq);
-            if (dsq < cutoff)
-            {                   // Drop all in between as all within margin - otherwise process A to M again.
-               if (A != B)
-                  for (fix_t * X = A->next; X && X != B; X = X->next)
-                     X->deleted = 1;
-               // Find next half
-               A = B;
-               M = A->next;
-               while (M && !M->corner)
-                  M = M->next;
-            }
-         }
       while (fixpack.base && fixpack.base != E)
       {
          fix_t *X = fixget (&fixpack);
+         pack_done (&pack, X);
          fixadd (X->deleted && !X->waypoint ? &fixfree : &fixsd, X);
       }
    }
    vTaskDelete (NULL);
 }
 
+void
+pack_stats (jo_t j)
+{                               // Add packing stats for journey
+   if (!packdist || !packmin || !pack.stats.fixes)
+      return;
+   jo_object (j, "pack");
+   jo_int (j, "fixes", pack.stats.fixes);
+   jo_int (j, "kept", pack.stats.fixes - pack.stats.deleted);
+   jo_int (j, "corners", pack.stats.corners);
+   jo_int (j, "deleted", pack.stats.deleted);
+   jo_litf (j, "maxdev", "%.2f", sqrtf (pack.stats.dsq));        // As packed, so includes time if packtime, or SED if packsed
+   jo_int (j, "peak", pack.stats.peak);
+   jo_int (j, "scans", pack.stats.scans);
+   jo_litf (j, "cpu", "%lld.%03lld", pack.stats.us / 1000000LL, pack.stats.us / 1000LL % 1000LL);
+   jo_close (j);
+}
+
+void
+sd_stats (jo_t j, const char *tag, sdlog_stats_t * s)
+{                               // Add SD write stats, for journey or since boot
+   if (!s->writes)
+      return;
+   jo_object (j, tag);
+   jo_int (j, "bytes", s->bytes);
+   if (s->written != s->bytes)
+      jo_int (j, "written", s->written);
+   jo_int (j, "writes", s->writes);
+   if (s->errors)
+      jo_int (j, "errors", s->errors);
+   jo_litf (j, "busy", "%lld.%03lld", s->us / 1000000LL, s->us / 1000LL % 1000LL);
+   jo_litf (j, "max", "%lu.%03lu", s->maxus / 1000000UL, s->maxus / 1000UL % 1000UL);
+   jo_int (j, "p50", sdlog_percentile (s, 50)); // ms
+   jo_int (j, "p99", sdlog_percentile (s, 99)); // ms
+   if (s->stallus)
+   {
+      jo_litf (j, "stall", "%lld.%03lld", s->stallus / 1000000LL, s->stallus / 1000LL % 1000LL);
+      jo_litf (j, "maxstall", "%lu.%03lu", s->maxstallus / 1000000UL, s->maxstallus / 1000UL % 1000UL);
+   }
+   if (s->syncs)
+   {
+      jo_int (j, "syncs", s->syncs);
+      jo_litf (j, "synctime", "%lld.%03lld", s->syncus / 1000000LL, s->syncus / 1000LL % 1000LL);
+      jo_litf (j, "maxsync", "%lu.%03lu", s->maxsyncus / 1000000UL, s->maxsyncus / 1000UL % 1000UL);
+   }
+   if (s->us)
+      jo_int (j, "rate", s->written * 1000000LL / 1024LL / s->us);      // KiB/s
+   if (s->zus)
+   {
+      jo_int (j, "raw", s->raw);
+      jo_litf (j, "compress", "%lld.%03lld", s->zus / 1000000LL, s->zus / 1000LL % 1000LL);
+   }
+   if (s->hashus)
+      jo_litf (j, "hash", "%lld.%03lld", s->hashus / 1000000LL, s->hashus / 1000LL % 1000LL);
+   if (sdmountus)
+      jo_litf (j, "mount", "%lu.%03lu", sdmountus / 1000000UL, sdmountus / 1000UL % 1000UL);
+   if (sdfree)
+   {
+      jo_int (j, "free", sdfree);
+      jo_int (j, "freechange", (int64_t) sdfree - (int64_t) sdfreemount);       // Since mount
+   }
+   jo_close (j);
+}
+
+void
+sd_recover (void)
+{                               // Finish a log file left open, e.g. power lost whilst logging, using what was written at last checkpoint
+   FILE *m = fopen (openlog, "r");
+   if (!m)
+      return;
+   char filename[100];
+   int l = fread (filename, 1, sizeof (filename) - 1, m);
+   fclose (m);
+   unlink (openlog);
+   if (l <= 0)
+      return;
+   filename[l] = 0;
+   FILE *o = fopen (filename, "r+");
+   if (!o)
+      return;
+   fseek (o, 0, SEEK_END);
+   long size = ftell (o);
+   long end = -1;               // Valid length
+   uint8_t gps = 1;             // JSON has gps array
+   char *endts = NULL,
+      *endlat = NULL,
+      *endlon = NULL;
+   const char *e = strrchr (filename, '.') ? : "";
+#define	TAIL	8192
+   if (!strcasecmp (e, "." LOGBIN_EXT))
+   {                            // Records are self delimiting, check all, and find last fix
+      uint8_t *data = mallocspi (LOGBIN_MAX);
+      fix_t *f = mallocspi (sizeof (*f) * 2),
+         *last = f + 1;
+      uint8_t got = 0;
+      logbin_t s = { 0 };
+      char magic[sizeof (LOGBIN_MAGIC) - 1];
+      fseek (o, 0, SEEK_SET);
+      if (data && f && fread (magic, sizeof (magic), 1, o) == 1 && !memcmp (magic, LOGBIN_MAGIC, sizeof (magic)))
+      {
+         while (1)
+         {
+            int c = fgetc (o),
+               b = 0;
+            uint32_t len = 0;
+            for (int shift = 0; shift < 28 && (b = fgetc (o)) != EOF; shift += 7)
+            {
+               len |= (b & 0x7F) << shift;
+               if (!(b & 0x80))
+                  break;
+            }
+            if (c == EOF || b == EOF || (b & 0x80) || ftell (o) + len > size)
+               break;
+            if (c == LOGBIN_FIX && len <= LOGBIN_MAX)
+            {
+               if (fread (data, len, 1, o) != 1)
+                  break;
+               logbin_decode (&s, data, len, f, NULL);
+               if (f->sett && f->setlla)
+               {
+                  *last = *f;
+                  got = 1;
+               }
+            } else
+               fseek (o, len, SEEK_CUR);
+            end = ftell (o);
+         }
+      }
+      if (got)
+      {
+         char ts[30];
+         if (getts (ts, last->ecef.t, 0))
+            endts = strdup (ts);
+         asprintf (&endlat, "%.9lf", last->lat);
+         asprintf (&endlon, "%.9lf", last->lon);
+      }
+      free (f);
+      free (data);
+   } else
+   {                            // Check the end of the file
+      long from = (size > TAIL ? size - TAIL : 0);
+      char *buf = mallocspi (TAIL + 1);
+      if (buf)
+      {
+         fseek (o, from, SEEK_SET);
+         int len = fread (buf, 1, TAIL, o);
+         buf[len > 0 ? len : 0] = 0;
+         char *p = NULL,
+            *q;
+         if (!strcasecmp (e, ".gpx"))
+         {                      // After last whole trkpt, or header
+            for (q = buf; (q = strstr (q, "</trkpt>\r\n")); q += 10)
+               p = q + 10;
+            if (!p && !from && (q = strstr (buf, LOGGPX_TRK)))
+               p = q + 10;
+         } else
+         {                      // After last fix with a line after it, or header
+            for (q = buf; (q = strstr (q, "},\r\n")); q += 4)
+               p = q + 1;
+            if (p)
+            {                   // Last fix, for end info
+               *p = 0;
+               char *f = strrchr (buf, '\n') ? : buf;
+               char *v (const char *tag, const char *chars)
+               {
+                  char *t = strstr (f, tag);
+                  if (!t)
+                     return NULL;
+                  t += strlen (tag);
+                  return strndup (t, strspn (t, chars));
+               }
+               endts = v ("\"ts\":\"", "0123456789-:.TZ");
+               endlat = v ("\"lat\":", "0123456789-.");
+               endlon = v ("\"lon\":", "0123456789-.");
+            } else if (!from && (q = strstr (buf, "\r\n")))
+            {                   // No fixes
+               p = q + 2;
+               *q = 0;
+               gps = (strstr (buf, "\"gps\":[") ? 1 : 0);
+            }
+         }
+         if (p)
+            end = from + (p - buf);
+         free (buf);
+      }
+   }
+   jo_t j = jo_object_alloc ();
+   jo_string (j, "filename", filename + sizeof (sd_mount));
+   if (end < 0 && size > TAIL)
+   {                            // Not as expected, leave as is
+      fclose (o);
+      jo_string (j, "error", cardstatus = "Cannot recover log file");
+      revk_error ("SD", &j);
+   } else if (end < 0)
+   {                            // Not even the start
+      fclose (o);
+      unlink (filename);
+      jo_string (j, "error", cardstatus = "Deleted unrecoverable log file");
+      revk_error ("SD", &j);
+   } else
+   {
+      fflush (o);
+      ftruncate (fileno (o), end);
+      fseek (o, end, SEEK_SET);
+      if (!strcasecmp (e, ".gpx"))
+         fprintf (o, LOGGPX_TRKEND LOGGPX_END);
+      else
+      {
+         jo_t j = jo_object_alloc ();
+         if (endts)
+         {
+            jo_object (j, "end");
+            jo_string (j, "ts", endts);
+            if (endlat && endlon)
+            {
+               jo_litf (j, "lat", "%s", endlat);
+               jo_litf (j, "lon", "%s", endlon);
+            }
+            jo_close (j);
+         }
+         jo_bool (j, "recovered", 1);
+         char *json = jo_finisha (&j);
+         int len = strlen (json);
+         if (!strcasecmp (e, "." LOGBIN_EXT))
+         {
+            uint8_t h[6];
+            fwrite (h, logbin_header (h, LOGBIN_JSON, len), 1, o);
+            fwrite (json, len, 1, o);
+         } else
+         {
+            if (gps)
+               fprintf (o, "\r\n ]");
+            fprintf (o, ",\r\n%s\r\n", json + 1);
+         }
+         free (json);
+      }
+      fclose (o);
+      jo_string (j, "action", cardstatus = "Recovered log file");
+      jo_int (j, "size", end);
+      revk_info ("SD", &j);
+   }
+#undef	TAIL
+   free (endts);
+   free (endlat);
+   free (endlon);
+}
+
+typedef struct upfile_s upfile_t;
+struct upfile_s
+{                               // File waiting to upload
+   upfile_t *next;
+   uint32_t size;               // Size when closed, 0 if not known (found by scan, until needed)
+   uint8_t tries;               // Failed uploads
+   const char *deferred;        // Why not sent in this upload session, NULL if not looked at yet
+   uint8_t hashed;              // sha256 is known
+   uint8_t sha256[SDLOG_SHA256];        // SHA-256 of file, as on card
+   char name[];                 // Full path
+};
+upfile_t *upfiles = NULL;       // Files waiting to upload, from one scan per mount, then updated as files are closed and uploaded
+uint8_t upscanned = 0;          // upfiles is from scan of card
+
+const char *
+upload_type (const char *name, uint8_t * gz)
+{                               // Content type for file to upload, NULL if not one we upload, gz set if compressed
+   const char *e = strrchr (name, '.');
+   if (!e)
+      return NULL;
+   if ((*gz = !strcasecmp (e, LOGZ_EXT)))
+      while (--e > name && *e != '.');
+   int isext (const char *x)
+   {
+      int l = strlen (x);
+      return !strncasecmp (e, x, l) && (*gz ? !strcasecmp (e + l, LOGZ_EXT) : !e[l]);
+   }
+   if (isext (".json"))
+      return "application/json";
+   if (isext (".gpx"))
+      return "application/gpx+xml";
+   if (isext ("." LOGBIN_EXT))
+      return "application/octet-stream";
+   if (isext (".csv"))
+      return "text/csv";
+   return NULL;
+}
+
+uint32_t
+upload_size (upfile_t * u)
+{                               // Size, from card if not known
+   struct stat s;
+   if (!u->size && !stat (u->name, &s))
+      u->size = s.st_size;
+   return u->size;
+}
+
+int
+upload_hash (upfile_t * u)
+{                               // SHA-256, reading file if not worked out as it was written (e.g. found by scan), 0 if known
+   if (u->hashed)
+      return 0;
+   FILE *i = sdread_open (u->name, uploadbuffer * 1024);
+   if (!i)
+      return -1;
+   uint8_t *buf = mallocspi (4096);
+   mbedtls_sha256_context sha;
+   mbedtls_sha256_init (&sha);
+   mbedtls_sha256_starts (&sha, 0);
+   size_t l;
+   while (buf && (l = fread (buf, 1, 4096, i)) > 0)
+      mbedtls_sha256_update (&sha, buf, l);
+   if (buf && !ferror (i) && !mbedtls_sha256_finish (&sha, u->sha256))
+      u->hashed = 1;
+   mbedtls_sha256_free (&sha);
+   free (buf);
+   fclose (i);
+   return u->hashed ? 0 : -1;
+}
+
+#define	UPLOAD_DIGEST	64      // Space for Repr-Digest value
+
+void
+upload_digest (upfile_t * u, char *d)
+{                               // Repr-Digest value (RFC 9530), sha-256=:base64:, empty if not known
+   size_t l = 0;
+   *d = 0;
+   if (!u->hashed || mbedtls_base64_encode ((unsigned char *) d + 9, UPLOAD_DIGEST - 10, &l, u->sha256, SDLOG_SHA256))
+      return;
+   memcpy (d, "sha-256=:", 9);
+   strcpy (d + 9 + l, ":");
+}
+
+int
+upload_match (upfile_t * u, const char *digest)
+{                               // If Repr-Digest from server has our SHA-256
+   char d[UPLOAD_DIGEST];
+   upload_digest (u, d);
+   return *d && strstr (digest, d);
+}
+
+int
+upload_csv (upfile_t * u)
+{                               // If CSV summary file
+   uint8_t gz;
+   const char *ct = upload_type (u->name, &gz);
+   return ct && !strcmp (ct, "text/csv");
+}
+
+int
+upload_cmp (upfile_t * a, upfile_t * b)
+{                               // Negative if a should be sent before b, by uploadorder, then fewer failed tries, else 0 (list order)
+   const char *p = uploadorder;
+   while (*p)
+   {
+      int l = strcspn (p, ", "),
+         c = 0;
+      if (l == 3 && !strncasecmp (p, "csv", l))
+         c = upload_csv (b) - upload_csv (a);
+      else if (l == 3 && !strncasecmp (p, "new", l))
+         c = strcmp (strrchr (b->name, '/'), strrchr (a->name, '/'));  // Names start with timestamp
+      else if (l == 3 && !strncasecmp (p, "old", l))
+         c = strcmp (strrchr (a->name, '/'), strrchr (b->name, '/'));
+      else if (l == 5 && !strncasecmp (p, "small", l))
+         c = (upload_size (a) > upload_size (b)) - (upload_size (a) < upload_size (b));
+      else if (l == 5 && !strncasecmp (p, "large", l))
+         c = (upload_size (a) < upload_size (b)) - (upload_size (a) > upload_size (b));
+      if (c)
+         return c;
+      p += l;
+      p += strspn (p, ", ");
+   }
+   return (int) a->tries - (int) b->tries;
+}
+
+upfile_t *
+upload_next (void)
+{                               // Next file to send, of those not looked at this upload session
+   upfile_t *best = NULL;
+   for (upfile_t * u = upfiles; u; u = u->next)
+      if (!u->deferred && (!best || upload_cmp (u, best) < 0))
+         best = u;
+   return best;
+}
+
+void
+upload_add (const char *filename, uint32_t size, const uint8_t * sha256)
+{                               // Closed file to upload, SHA-256 if worked out as written, else NULL
+   if (!upscanned)
+      return;                   // Scan will find it
+   upfile_t **u = &upfiles;
+   while (*u && strcmp ((*u)->name, filename))
+      u = &(*u)->next;
+   if (!*u)
+   {                            // New, at end
+      *u = mallocspi (sizeof (upfile_t) + strlen (filename) + 1);
+      if (!*u)
+         return;
+      memset (*u, 0, sizeof (upfile_t));
+      strcpy ((*u)->name, filename);
+   }
+   (*u)->size = size;
+   if (((*u)->hashed = (sha256 ? 1 : 0)))
+      memcpy ((*u)->sha256, sha256, SDLOG_SHA256);
+   b.sdempty = 0;
+   b.sdwaiting = 1;
+}
+
+#define	UPLOAD_PART	".up"           // Added to file name for file holding upload progress, there once sending has started
+
+int64_t
+upload_getoffset (const char *filename)
+{                               // Bytes of file the server has, from upload progress file, -1 if never started sending
+   char *p = NULL;
+   asprintf (&p, "%s" UPLOAD_PART, filename);
+   if (!p)
+      return 0;
+   long long offset = -1;
+   FILE *f = fopen (p, "r");
+   if (f)
+   {
+      if (fscanf (f, "%lld", &offset) != 1 || offset < 0)
+         offset = 0;            // Started, but no progress
+      fclose (f);
+   }
+   free (p);
+   return offset;
+}
+
+void
+upload_setoffset (const char *filename, int64_t offset)
+{                               // Record bytes of file the server has, 0 for started sending, -1 to remove progress file
+   char *p = NULL;
+   asprintf (&p, "%s" UPLOAD_PART, filename);
+   if (!p)
+      return;
+   if (offset < 0)
+      unlink (p);
+   else
+   {
+      FILE *f = fopen (p, "w");
+      if (f)
+      {
+         fprintf (f, "%lld\n", (long long) offset);
+         fclose (f);
+      }
+   }
+   free (p);
+}
+
+int
+upload_tried (upfile_t * u)
+{                               // If sending file started before, failed this boot, or progress file from before
+   return u->tries || upload_getoffset (u->name) >= 0;
+}
+
+void
+upload_clear (void)
+{                               // Forget list, e.g. card dismounted
+   while (upfiles)
+   {
+      upfile_t *u = upfiles;
+      upfiles = u->next;
+      free (u);
+   }
+   upscanned = 0;
+}
+
+int
+upload_scan (void)
+{                               // Make list of files to upload, once per mount, in the root and YYYY/MM directories
+   upload_clear ();
+   int scan (const char *path, int depth)
+   {
+      DIR *dir = opendir (path);
+      if (!dir)
+         return -1;
+      struct dirent *entry;
+      while ((entry = readdir (dir)))
+      {
+         char filename[300];
+         snprintf (filename, sizeof (filename), "%s/%s", path, entry->d_name);
+         uint8_t gz;
+         if (entry->d_type == DT_REG && upload_type (entry->d_name, &gz))
+            upload_add (filename, 0, NULL);
+         else if (entry->d_type == DT_DIR && depth < 2 && strlen (entry->d_name) == (depth ? 2 : 4)
+                  && strspn (entry->d_name, "0123456789") == strlen (entry->d_name))
+            scan (filename, depth + 1);
+      }
+      closedir (dir);
+      return 0;
+   }
+   upscanned = 1;
+   if (scan (sd_mount, 0))
+   {
+      upscanned = 0;
+      return -1;
+   }
+   return 0;
+}
+
+int
+sd_unlink (const char *filename)
+{                               // Delete file, and its YYYY/MM directories once empty
+   if (unlink (filename))
+      return -1;
+   char path[300];
+   strncpy (path, filename, sizeof (path) - 1);
+   path[sizeof (path) - 1] = 0;
+   char *d;
+   while ((d = strrchr (path, '/')) && d > path + sizeof (sd_mount) - 1)
+   {
+      *d = 0;
+      if (rmdir (path))
+         break;
+   }
+   return 0;
+}
+
+void
+sd_space (void)
+{                               // Keep sdreserve free, deleting oldest journey logs waiting to upload, so logging does not stop when card full (CSV summaries kept)
+   if (!sdreserve || (!upscanned && upload_scan ()))
+      return;
+   int deleted = 0;
+   while (!esp_vfs_fat_info (sd_mount, &sdsize, &sdfree) && sdfree < (uint64_t) sdreserve * 1024ULL * 1024ULL)
+   {
+      upfile_t **o = NULL;
+      for (upfile_t ** u = &upfiles; *u; u = &(*u)->next)
+         if (!upload_csv (*u) && (!o || strcmp (strrchr ((*u)->name, '/'), strrchr ((*o)->name, '/')) < 0))
+            o = u;              // Names start with timestamp, so oldest is lowest
+      if (!o)
+         break;                 // No journey logs left to delete
+      upfile_t *u = *o;
+      *o = u->next;
+      upload_setoffset (u->name, -1);
+      if (sd_unlink (u->name))
+      {
+         jo_t j = jo_object_alloc ();
+         jo_string (j, "error", "Failed to delete");
+         jo_string (j, "filename", u->name + sizeof (sd_mount));
+         revk_error ("SD", &j);
+      } else
+      {
+         ESP_LOGI (TAG, "Deleted for space %s", u->name);
+         deleted++;
+      }
+      free (u);
+   }
+   if (!upfiles)
+   {
+      b.sdwaiting = 0;
+      b.sdempty = 1;
+   }
+   if (deleted)
+   {
+      jo_t j = jo_object_alloc ();
+      jo_string (j, "action", cardstatus = "Deleted oldest logs, not uploaded, for space");
+      jo_int (j, "deleted", deleted);
+      jo_int (j, "free", sdfree);
+      revk_info ("SD", &j);
+   }
+}
+
+char *
+sd_dir (char *buf, const char *ts)
+{                               // Directory for a file named from ts (YYYY-MM-...), made if needed, buf at least 20 bytes
+   sprintf (buf, "%s/%.4s", sd_mount, ts);
+   mkdir (buf, 0777);
+   sprintf (buf + strlen (buf), "/%.2s", ts + 5);
+   mkdir (buf, 0777);
+   return buf;
+}
+
+void
+sd_migrate (void)
+{                               // Move files to upload from the root to YYYY/MM directories, as large directories are slow on FAT
+   DIR *dir = opendir (sd_mount);
+   if (!dir)
+      return;
+   upfile_t *list = NULL;       // Names, as renaming whilst reading the directory is not safe
+   struct dirent *entry;
+   while ((entry = readdir (dir)))
+   {
+      uint8_t gz;
+      const char *n = entry->d_name;
+      if (entry->d_type == DT_REG && upload_type (n, &gz) && strspn (n, "0123456789") == 4 && n[4] == '-'
+          && strspn (n + 5, "0123456789") == 2 && n[7] == '-')
+      {
+         upfile_t *u = mallocspi (sizeof (upfile_t) + strlen (n) + 1);
+         if (!u)
+            break;
+         strcpy (u->name, n);
+         u->next = list;
+         list = u;
+      }
+   }
+   closedir (dir);
+   if (!list)
+      return;
+   int64_t start = esp_timer_get_time ();
+   int moved = 0,
+      failed = 0;
+   while (list)
+   {
+      upfile_t *u = list;
+      list = u->next;
+      char from[300],
+        to[300],
+        d[20];
+      snprintf (from, sizeof (from), "%s/%s", sd_mount, u->name);
+      snprintf (to, sizeof (to), "%s/%s", sd_dir (d, u->name), u->name);
+      if (rename (from, to))
+         failed++;
+      else
+         moved++;
+      free (u);
+   }
+   int64_t us = esp_timer_get_time () - start;
+   jo_t j = jo_object_alloc ();
+   jo_string (j, "action", "Moved files to YYYY/MM directories");
+   jo_int (j, "moved", moved);
+   if (failed)
+      jo_int (j, "failed", failed);
+   jo_litf (j, "time", "%lld.%03lld", us / 1000000LL, us / 1000LL % 1000LL);
+   revk_info ("SD", &j);
+}
+
+int
+sd_rawmake (const char *filename)
+{                               // Make log file from live journey in raw region, return 0 if complete, 1 if end added, -1 if failed
+   FILE *i = lograw_reader (rawlog, LOGRAW_BLOCK);
+   if (!i)
+      return -1;
+   uint8_t gzip = (strstr (filename, LOGZ_EXT) ? loggzip ? : 6 : 0);   // As named, even if setting changed
+   int r = -1;
+   FILE *o = sdlog_open (filename, sdbuf * 1024, sdprealloc * 1024, gzip);
+   if (o)
+   {
+      r = logconv (i, o, strstr (filename, ".gpx") ? LOGCONV_GPX : strstr (filename, "." LOGBIN_EXT) ? LOGCONV_BIN : LOGCONV_JSON);
+      if (fclose (o))
+         r = -1;
+      if (r < 0)
+         unlink (filename);
+   }
+   fclose (i);
+   if (r >= 0)
+      lograw_done (rawlog);
+   return r;
+}
+
+int
+sd_rawrecover (void)
+{                               // Make log file from live journey left in raw region, e.g. power lost, -1 if still left there
+   FILE *i = lograw_reader (rawlog, LOGRAW_BLOCK);
+   if (!i)
+      return 0;                 // None
+   char *name = NULL;
+   {                            // Start record has filename
+      char *buf = mallocspi (1024);
+      if (buf)
+      {
+         int l = fread (buf, 1, 1023, i);
+         buf[l > 0 ? l : 0] = 0;
+         if (l > sizeof (LOGBIN_MAGIC) - 1 && !memcmp (buf, LOGBIN_MAGIC, sizeof (LOGBIN_MAGIC) - 1))
+            name = logconv_jsonstr (buf + sizeof (LOGBIN_MAGIC) - 1, "filename");
+         free (buf);
+      }
+   }
+   fclose (i);
+   if (!name)
+   {                            // Not a journey start, nothing to recover
+      lograw_done (rawlog);
+      return 0;
+   }
+   char *p = name,
+      *q = name;
+   while (*p)
+      if (*p == '\\' && p[1])
+      {                         // JSON escaped
+         *q++ = p[1];
+         p += 2;
+      } else
+         *q++ = *p++;
+   *q = 0;
+   char filename[300],
+     dir[20];
+   sd_dir (dir, strrchr (name, '/') ? strrchr (name, '/') + 1 : name);
+   snprintf (filename, sizeof (filename), "%s/%s", sd_mount, name);
+   free (name);
+   int r = sd_rawmake (filename);
+   jo_t j = jo_object_alloc ();
+   jo_string (j, "filename", filename + sizeof (sd_mount));
+   if (r < 0)
+   {
+      jo_string (j, "error", cardstatus = "Cannot make log file from live journey");
+      revk_error ("SD", &j);
+      return -1;
+   }
+   jo_string (j, "action", cardstatus = r ? "Recovered log file" : "Made log file from live journey");
+   jo_int (j, "size", sdlog_stats.bytes);
+   revk_info ("SD", &j);
+   uint8_t sha256[SDLOG_SHA256];
+   upload_add (filename, sdlog_stats.bytes, sdlog_sha256 (sha256) ? NULL : sha256);
+   return 0;
+}
+
+typedef struct upsession_s upsession_t;
+struct upsession_s
+{                               // Upload session, updated from HTTP client events
+   uint32_t connects;           // Connections made, each is a TLS handshake if https
+   int64_t offset;              // Upload-Offset in response, -1 if none
+   char digest[UPLOAD_DIGEST];  // Repr-Digest in response, empty if none
+};
+
+static esp_err_t
+upload_event (esp_http_client_event_t * e)
+{
+   upsession_t *s = e->user_data;
+   if (e->event_id == HTTP_EVENT_ON_CONNECTED)
+      s->connects++;
+   else if (e->event_id == HTTP_EVENT_ON_HEADER && !strcasecmp (e->header_key, "Upload-Offset"))
+      s->offset = strtoll (e->header_value, NULL, 10);
+   else if (e->event_id == HTTP_EVENT_ON_HEADER && !strcasecmp (e->header_key, "Repr-Digest"))
+      strncpy (s->digest, e->header_value, sizeof (s->digest) - 1);
+   return ESP_OK;
+}
+
+#define	UPLOAD_BOUNDARY	"GPSLoggerUploadBatch"
+
 void
 checkupload (void)
 {
@@ -1438,6 +2045,12 @@ checkupload (void)
       revk_enable_wifi ();
    uint32_t up = uptime ();
    static uint32_t delay = 0;
+   static uint32_t visit = 0;   // Last called, a visit (for budget) is until off line or not called for a while, e.g. driven away
+   static uint64_t visitbytes = 0;      // Uploaded this visit
+   static uint64_t visitus = 0; // Time uploading this visit
+   if (revk_link_down () || up > visit + 300)
+      visitbytes = visitus = 0;
+   visit = up;
    if (delay > up)
       return;
    if (b.sdempty)
@@ -1458,184 +2071,567 @@ checkupload (void)
       delay = up + 10;
       return;
    }
+#define	BLOCK	16384           // Sent at a time, a whole TLS record
+   esp_http_client_handle_t client = NULL;      // Kept for the session, so one connection, and TLS handshake, if the server keeps alive
+   upsession_t session = { 0 };
+   uint32_t files = 0;          // Files uploaded this session
+   uint32_t dupes = 0;          // Files the server already had
+   uint64_t bytes = 0;          // Bytes uploaded this session
+   int64_t started = esp_timer_get_time ();
+   const char *stopped = NULL;  // Why session stopped before all files looked at
+   const char *paused = NULL;   // Why resumable upload stopped between chunks
+   const char *budget (upfile_t * u, uint64_t more)
+   {                            // Why file would not fit in budget for this visit, along with more bytes, NULL if it fits
+      uint64_t size = upload_size (u);
+      if (uploadchunk && size > uploadchunk * 1024)
+      {                         // Resumable, only what the server does not have, and a chunk at a time, so fits if the next chunk does
+         int64_t offset = upload_getoffset (u->name);
+         if ((uint64_t) offset < size)
+            size -= offset;
+         if (size > uploadchunk * 1024)
+            size = uploadchunk * 1024;
+      }
+      size += more;
+      uint64_t sent = visitbytes + bytes,
+         us = visitus + esp_timer_get_time () - started;
+      if (uploaddata && sent + size > (uint64_t) uploaddata * 1024ULL)
+         return "data budget";
+      if (uploadtime && (us >= uploadtime * 1000000ULL || (sent && us + size * us / sent > uploadtime * 1000000ULL)))
+         return "time budget";  // Out of time, or would not finish in time at the rate so far
+      return NULL;
+   }
+   for (upfile_t * u = upfiles; u; u = u->next)
+      u->deferred = NULL;
+   memset (&sdread_stats, 0, sizeof (sdread_stats));
+   char *buf = NULL;            // Block being sent
+   char *nname = NULL;          // Next file, if opened ahead
+   FILE *ni = NULL;
+   void unfetch (void)
+   {
+      if (ni)
+         fclose (ni);
+      ni = NULL;
+      free (nname);
+      nname = NULL;
+   }
+   void prefetch (uint64_t more)
+   {                            // Open file that will be sent next, which starts reading it, whilst server deals with this one (more is bytes being sent)
+      upfile_t *n = upload_next ();     // Those being sent are marked as such, so this is the next pick
+      if (ni || !n || budget (n, more) || !(ni = sdread_open (n->name, uploadbuffer * 1024)))
+         return;
+      nname = strdup (n->name);
+   }
+   FILE *take (const char *name)
+   {                            // Open file, the one opened ahead if that was this file
+      FILE *i = NULL;
+      if (ni && nname && !strcmp (nname, name))
+      {
+         i = ni;
+         ni = NULL;
+      }
+      unfetch ();
+      if (!i)
+         i = sdread_open (name, uploadbuffer * 1024);
+      return i;
+   }
+   char *target (upfile_t * f)
+   {                            // URL for file, or for batch if NULL
+      char *u = NULL;
+      if (f)
+         asprintf (&u, "%s?%s-%s", url, hostname, strrchr (f->name, '/') + 1);
+      else
+         asprintf (&u, "%s?%s", url, hostname);
+      if (u)
+         for (char *p = u + strlen (url) + 1; *p; p++)
+            if (!is_alnum (*p) && *p != '.')
+               *p = '-';
+      return u;
+   }
+   int use (const char *u, esp_http_client_method_t method)
+   {                            // Set up client for request, on kept alive connection if there is one, 0 if OK
+      if (client)
+         esp_http_client_set_url (client, u);
+      else
+      {
+         esp_http_client_config_t config = {
+            .url = u,
+            .crt_bundle_attach = esp_crt_bundle_attach,
+            .method = method,
+            .event_handler = upload_event,
+            .user_data = &session,
+         };
+         if (!(client = esp_http_client_init (&config)))
+            return -1;
+      }
+      esp_http_client_set_method (client, method);
+      session.offset = -1;
+      *session.digest = 0;
+      return 0;
+   }
+   int probe (upfile_t * f)
+   {                            // Ask server if it has this file already (HEAD with Repr-Digest), 1 if it sends back the same SHA-256
+      char d[UPLOAD_DIGEST];
+      upload_digest (f, d);
+      char *u = (*d ? target (f) : NULL);
+      int found = 0;
+      for (int try = 0; try < 2 && u; try++)
+      {
+         uint32_t was = session.connects;
+         if (use (u, HTTP_METHOD_HEAD))
+            break;
+         esp_http_client_set_header (client, "Repr-Digest", d);
+         esp_http_client_delete_header (client, "Content-Encoding");
+         esp_http_client_delete_header (client, "Upload-Offset");
+         esp_http_client_delete_header (client, "Upload-Length");
+         int l = 0;
+         if (!esp_http_client_open (client, 0) && esp_http_client_fetch_headers (client) >= 0
+             && !esp_http_client_flush_response (client, &l))
+         {
+            found = (esp_http_client_get_status_code (client) / 100 == 2 && upload_match (f, session.digest));
+            break;
+         }
+         esp_http_client_cleanup (client);
+         client = NULL;
+         if (session.connects != was)
+            break;              // Failed on new connection
+      }
+      free (u);
+      return found;
+   }
+   int post (int n, upfile_t ** f, struct stat *st, const char **ct, uint8_t * gz)
+   {                            // POST file as the body, or in resumable chunks, or files as multipart/form-data if more than one, return response code
+      if (!buf && !(buf = mallocspi (BLOCK)))
+         return 0;
+      char *u = target (n == 1 ? f[0] : NULL);
+      if (!u)
+         return 0;
+      char d[UPLOAD_DIGEST];
+      char *head[n];            // Multipart headers
+      size_t len = 0;
+      for (int k = 0; k < n; k++)
+      {
+         head[k] = NULL;
+         if (n > 1)
+         {
+            upload_digest (f[k], d);
+            asprintf (&head[k],
+                      "%s--" UPLOAD_BOUNDARY "\r\nContent-Disposition: form-data; name=\"file\"; filename=\"%s\"\r\nContent-Type: %s\r\n%s%s%s\r\n",
+                      k ? "\r\n" : "", strrchr (f[k]->name, '/') + 1, gz[k] ? "application/gzip" : ct[k], *d ? "Repr-Digest: " : "", d,
+                      *d ? "\r\n" : "");
+            if (head[k])
+               len += strlen (head[k]);
+         }
+         len += st[k].st_size;
+      }
+      const char tail[] = "\r\n--" UPLOAD_BOUNDARY "--\r\n";
+      if (n > 1)
+         len += sizeof (tail) - 1;
+      off_t chunk = 0;          // Resumable, sending chunk at offset
+      off_t offset = 0;
+      if (n == 1 && uploadchunk && st[0].st_size > uploadchunk * 1024)
+      {
+         chunk = uploadchunk * 1024;
+         if ((offset = upload_getoffset (f[0]->name)) < 0 || offset >= st[0].st_size)
+            offset = 0;         // Not sensible, server will say if it has it
+      }
+      int response = 0;
+      int conflicts = 0;        // Chunks not making progress
+      while (1)
+      {
+         if (chunk)
+            len = (st[0].st_size - offset < chunk ? st[0].st_size - offset : chunk);
+         response = 0;
+         for (int try = 0; try < 2; try++)
+         {
+            uint32_t was = session.connects;
+            if (use (u, HTTP_METHOD_POST))
+               break;
+            if (n > 1)
+            {
+               esp_http_client_set_header (client, "Content-Type", "multipart/form-data; boundary=" UPLOAD_BOUNDARY);
+               esp_http_client_delete_header (client, "Content-Encoding");
+               esp_http_client_delete_header (client, "Repr-Digest");  // In each part
+            } else
+            {
+               upload_digest (f[0], d);
+               if (*d)
+                  esp_http_client_set_header (client, "Repr-Digest", d);
+               else
+                  esp_http_client_delete_header (client, "Repr-Digest");
+               esp_http_client_set_header (client, "Content-Type", ct[0]);
+               if (gz[0])
+                  esp_http_client_set_header (client, "Content-Encoding", "gzip");
+               else
+                  esp_http_client_delete_header (client, "Content-Encoding");
+            }
+            if (chunk)
+            {
+               char v[24];
+               sprintf (v, "%lld", (long long) offset);
+               esp_http_client_set_header (client, "Upload-Offset", v);
+               sprintf (v, "%lld", (long long) st[0].st_size);
+               esp_http_client_set_header (client, "Upload-Length", v);
+            } else
+            {
+               esp_http_client_delete_header (client, "Upload-Offset");
+               esp_http_client_delete_header (client, "Upload-Length");
+            }
+            ESP_LOGI (TAG, "Sending %s %ld%s at %ld", f[0]->name, st[0].st_size, n > 1 ? " and more" : "", (long) offset);
+            int e = esp_http_client_open (client, len);
+            for (int k = 0; k < n && !e; k++)
+            {
+               if (head[k] && esp_http_client_write (client, head[k], strlen (head[k])) < 0)
+                  e = -1;
+               off_t size = (chunk ? len : st[k].st_size);      // To send from this file
+               int l = 0;
+               FILE *i = NULL;
+               if (!e && (!(i = take (f[k]->name)) || (offset && fseek (i, offset, SEEK_SET))))
+                  e = -1;
+               if (!e)
+                  l = fread (buf, 1, BLOCK, i);
+               off_t total = 0;
+               while (!e && l > 0)
+               {
+                  if (l > size - total)
+                     l = size - total;
+                  if (esp_http_client_write (client, buf, l) != l)
+                     e = -1;
+                  total += l;
+                  upload = (offset + total) * 100 / st[k].st_size;
+                  ESP_LOGI (TAG, "%ld bytes (%d%%)", (long) (offset + total), upload);
+                  busy = uptime ();
+                  l = (total < size) ? fread (buf, 1, BLOCK, i) : 0;
+               }
+               if (i)
+                  fclose (i);
+               if (total != size)
+                  e = -1;       // File changed, Content-Length now wrong
+            }
+            if (!e && n > 1 && esp_http_client_write (client, tail, sizeof (tail) - 1) < 0)
+               e = -1;
+            if (!e)
+            {
+               prefetch (len);  // Read ahead whilst the server deals with this
+               if (esp_http_client_fetch_headers (client) < 0)
+                  e = -1;
+               else
+               {
+                  int l = 0;
+                  esp_http_client_flush_response (client, &l);
+                  if (!(response = esp_http_client_get_status_code (client)))
+                     e = -1;
+               }
+            }
+            upload = 0;
+            if (!e)
+               break;
+            esp_http_client_cleanup (client);
+            client = NULL;
+            if (session.connects != was)
+               break;           // Failed on new connection, only try again if it was a kept alive one the server may have closed
+            ESP_LOGI (TAG, "Kept alive connection failed, trying new connection");
+         }
+         if (!chunk)
+            break;
+         off_t was = offset;
+         if (response / 100 == 2 && session.offset < 0)
+            offset += len;      // Chunk accepted, server did not say how much it has, so assume all of it
+         else if ((response / 100 == 2 || response == 409) && session.offset >= 0 && session.offset <= st[0].st_size)
+            offset = session.offset;    // Server says how much it has, carry on from there
+         else
+            break;              // Failed
+         if (offset > was)
+            bytes += offset - was;
+         if (response == 409)
+            ESP_LOGI (TAG, "Server has %lld, not %lld", (long long) offset, (long long) was);
+         if (offset == st[0].st_size)
+         {                      // All there
+            response = 200;
+            break;
+         }
+         if (offset > was)
+            conflicts = 0;
+         else if (++conflicts > 3)
+         {                      // Not getting anywhere
+            response = 409;
+            break;
+         }
+         upload_setoffset (f[0]->name, offset); // Progress, so not lost if we lose WiFi or power
+         if ((paused = budget (f[0], 0)))
+            break;              // Rest next visit
+      }
+      if (!chunk && response / 100 == 2)
+         for (int k = 0; k < n; k++)
+            bytes += st[k].st_size;
+      for (int k = 0; k < n; k++)
+         free (head[k]);
+      free (u);
+      return response;
+   }
    while (1)
    {
-      DIR *dir = opendir (sd_mount);
-      if (!dir)
+      if (!upscanned && upload_scan ())
       {                         // Error
          delay = up + 60;       // Don't try for a bit
          jo_t j = jo_object_alloc ();
          jo_stringf (j, "error", "Cannot open %s", sd_mount);
          revk_error ("SD", &j);
          ESP_LOGE (TAG, "Cannot open dir");
-         return;
+         break;
       }
-      char zap = 0;
-      char *filename = NULL;
-      const char *ct = NULL;
-      struct dirent *entry;
-      while (!filename && (entry = readdir (dir)))
-         if (entry->d_type == DT_REG)
-         {
-            const char *e = strrchr (entry->d_name, '.');
-            if (!e)
-               continue;
-            if (!strcasecmp (e, ".json"))
-               ct = "application/json";
-            else if (!strcasecmp (e, ".gpx"))
-               ct = "application/gpx+xml";
-            else if (!strcasecmp (e, ".csv"))
-               ct = "text/csv";
-            if (ct)
-               asprintf (&filename, "%s/%s", sd_mount, entry->d_name);
-         }
-      closedir (dir);
-      if (filename)
-      {
-         ESP_LOGI (TAG, "Waiting %s", filename);
-         b.sdwaiting = 1;
-         b.sdempty = 0;
-      } else
+      if (!upfiles)
       {
          b.sdwaiting = 0;
          b.sdempty = 1;
          ESP_LOGI (TAG, "No upload as empty");
          delay = up + 60;
-         return;
+         break;
+      }
+      b.sdwaiting = 1;
+      b.sdempty = 0;
+      upfile_t *u;
+      const char *why;
+      while ((u = upload_next ()) && (why = budget (u, 0)))
+      {
+         ESP_LOGI (TAG, "Deferred %s (%s)", u->name, why);
+         u->deferred = why;
+      }
+      if (!u)
+      {                         // All sent or deferred
+         delay = up + 60;
+         break;
       }
+      ESP_LOGI (TAG, "Waiting %s", u->name);
       if (revk_link_down ())
       {                         // Don't send or nothing to send
-         ESP_LOGI (TAG, "Not sending as off line (%s)", filename);
-         free (filename);
+         ESP_LOGI (TAG, "Not sending as off line (%s)", u->name);
+         stopped = "off line";
          break;
       }
-      if (revk_link_down () || !*url)
+      if (!*url)
       {                         // Don't send or nothing to send
-         ESP_LOGI (TAG, "Not sending as no URL (%s)", filename);
+         ESP_LOGI (TAG, "Not sending as no URL (%s)", u->name);
          delay = up + 3600;
-         free (filename);
+         stopped = "no url";
          break;
       }
-      busy = up;
-      struct stat s = { 0 };
-      jo_t makeerr (const char *e)
+      busy = uptime ();
+      uint8_t email = (strchr (url, '@') ? 1 : 0);
+      int max = (email || uploadbatch < 2) ? 1 : uploadbatch;   // Files in this POST
+      upfile_t *f[max];
+      struct stat st[max];
+      const char *ct[max];
+      uint8_t gz[max];          // Compressed, content type is that of the inner extension
+      uint8_t gone = 0;         // First file not there
+      int n = 0;
+      off_t more = 0;           // Size of files in batch so far
+      uint8_t retry = 0;        // First file started sending before, so server may have it
+      for (upfile_t * e = u; e && n < max; e = (n < max ? upload_next () : NULL))
+      {                         // First file, and next files if batch
+         memset (&st[n], 0, sizeof (st[n]));
+         ct[n] = upload_type (e->name, &gz[n]);
+         if (stat (e->name, &st[n]))
+         {
+            if (n)
+               break;           // Deal with on its own turn
+            gone = 1;
+         } else if (n && (!st[n].st_size || !ct[n] || upload_tried (e) || (uploadchunk && st[n].st_size > uploadchunk * 1024) || budget (e, more)))
+            break;
+         else if (st[n].st_size)
+            upload_hash (e);    // Not fatal if not known, just not checked
+         e->deferred = "sending";
+         more += st[n].st_size;
+         f[n++] = e;
+         if (n == 1)
+            retry = upload_tried (e);
+         if (!st[0].st_size || retry || (uploadchunk && st[0].st_size > uploadchunk * 1024))
+            break;              // Sent on its own, in resumable chunks, or after checking server does not have it already
+      }
+      jo_t makeerr (int k, const char *e)
       {
          jo_t j = jo_object_alloc ();
          if (e)
          {
             jo_string (j, "error", e);
-            if (filename)
-               ESP_LOGE (TAG, "%s: %s", e, filename);
+            ESP_LOGE (TAG, "%s: %s", e, f[k]->name);
          }
-         if (filename)
-            jo_string (j, "filename", filename + sizeof (sd_mount));
+         jo_string (j, "filename", f[k]->name + sizeof (sd_mount));
          jo_string (j, "url", url);
-         if (s.st_size)
-            jo_int (j, "size", s.st_size);
+         if (st[k].st_size)
+            jo_int (j, "size", st[k].st_size);
+         if (n > 1)
+            jo_int (j, "batch", n);
          return j;
       }
-      if (filename && *filename && !stat (filename, &s))
+      uint8_t zap = 0;
+      uint8_t tried = 0;        // Tried to send
+      int response = 0;
+      if (!gone)
       {                         // Send
          rgbsd = 'C';
-         if (!s.st_size)
+         *session.digest = 0;
+         if (!st[0].st_size)
          {
-            ESP_LOGI (TAG, "Empty file %s", filename);
+            ESP_LOGI (TAG, "Empty file %s", f[0]->name);
             zap = 1;            // Empty
-            jo_t j = makeerr ("Empty file");
+            jo_t j = makeerr (0, "Empty file");
             revk_error ("Upload", &j);
-         } else
+         } else if (!email && retry && probe (f[0]))
+         {                      // Started before, but server has it, e.g. response lost, or rebooted before it came
+            ESP_LOGI (TAG, "Server already has %s", f[0]->name);
+            zap = 1;
+            dupes++;
+            jo_t j = makeerr (0, NULL);
+            jo_bool (j, "duplicate", 1);
+            revk_info ("Uploaded", &j);
+         } else if (email)
          {
-            ESP_LOGI (TAG, "Send %s", filename);
-            int response = 0;
-            FILE *i = fopen (filename, "r");
+            ESP_LOGI (TAG, "Email %s", url);
+            FILE *i = take (f[0]->name);
             if (i)
             {
-               if (strchr (url, '@'))
-               {
-                  ESP_LOGI (TAG, "Email %s", url);
-                  response = email_send (url, ct, filename + sizeof (sd_mount), filename + sizeof (sd_mount), i, s.st_size);
-               } else
-               {
-                  char *u;
-                  asprintf (&u, "%s?%s-%s", url, hostname, filename + sizeof (sd_mount));
-                  for (char *p = u + strlen (url) + 1; *p; p++)
-                     if (!is_alnum (*p) && *p != '.')
-                        *p = '-';
-                  esp_http_client_config_t config = {
-                     .url = u,
-                     .crt_bundle_attach = esp_crt_bundle_attach,
-                     .method = HTTP_METHOD_POST,
-                  };
-#define	BLOCK	2048
-                  char *buf = mallocspi (BLOCK);
-                  if (buf)
-                  {
-                     esp_http_client_handle_t client = esp_http_client_init (&config);
-                     if (client)
-                     {
-                        esp_http_client_set_header (client, "Content-Type", ct);
-                        ESP_LOGI (TAG, "Sending %s %ld", filename, s.st_size);
-                        if (!esp_http_client_open (client, s.st_size))
-                        {       // Send
-                           int total = 0;
-                           int len = 0;
-                           while ((len = fread (buf, 1, BLOCK, i)) > 0)
-                           {
-                              total += len;
-                              upload = total * 100 / s.st_size;
-                              ESP_LOGI (TAG, "%d bytes (%d%%)", total, upload);
-                              esp_http_client_write (client, buf, len);
-                              busy = uptime ();
-                           }
-                           esp_http_client_fetch_headers (client);
-                           esp_http_client_flush_response (client, &len);
-                           response = esp_http_client_get_status_code (client);
-                           esp_http_client_close (client);
-                        }
-                        esp_http_client_cleanup (client);
-                     }
-                  }
-                  upload = 0;
-                  free (u);
-                  free (buf);
-#undef	BLOCK
-               }
-               ESP_LOGI (TAG, "Sent, Response %d", response);
+               const char *base = strrchr (f[0]->name, '/') + 1;        // File name without YYYY/MM
+               char d[UPLOAD_DIGEST];
+               upload_digest (f[0], d);
+               tried = 1;
+               response = email_send (url, gz[0] ? "application/gzip" : ct[0], base, base, d, i, st[0].st_size);
+               fclose (i);
                if (response / 100 == 2)
+                  bytes += st[0].st_size;
+            } else
+            {
+               jo_t j = makeerr (0, "Failed to open");
+               revk_error ("Upload", &j);
+            }
+         } else
+         {
+            ESP_LOGI (TAG, "Send %s", f[0]->name);
+            for (int k = retry ? 1 : 0; k < n; k++)
+               upload_setoffset (f[k]->name, 0);        // Started, kept over reboot, so checked with server next time
+            tried = 1;
+            response = post (n, f, st, ct, gz);
+         }
+         if (tried && !paused)
+         {
+            ESP_LOGI (TAG, "Sent, Response %d", response);
+            uint8_t mismatch = (n == 1 && response / 100 == 2 && *session.digest && !upload_match (f[0], session.digest));
+            for (int k = 0; k < n; k++)
+               if (response / 100 == 2 && !mismatch)
                {
-                  jo_t j = makeerr (NULL);
+                  jo_t j = makeerr (k, NULL);
                   revk_info ("Uploaded", &j);
                   zap = 1;
+                  files++;
                } else
                {
-                  jo_t j = makeerr ("Failed to upload");
+                  jo_t j = makeerr (k, mismatch ? "Server has different SHA-256" : "Failed to upload");
                   jo_int (j, "response", response);
                   revk_error ("Upload", &j);
                }
-               fclose (i);
-            } else
+         }
+      }
+      if (zap)
+         for (int k = 0; k < n; k++)
+         {
+            ESP_LOGI (TAG, "Delete %s", f[k]->name);
+            upload_setoffset (f[k]->name, -1);
+            if (sd_unlink (f[k]->name))
             {
-               jo_t j = makeerr ("Failed to open");
+               jo_t j = makeerr (k, "Failed to delete");
                revk_error ("Upload", &j);
             }
          }
-      }
-      if (zap)
-      {
-         ESP_LOGI (TAG, "Delete %s", filename);
-         if (unlink (filename))
+      if (zap || gone)
+      {                         // Done, or gone
+         for (int k = 0; k < n; k++)
          {
-            jo_t j = makeerr ("Failed to delete");
-            revk_error ("Upload", &j);
+            upfile_t **e = &upfiles;
+            while (*e && *e != f[k])
+               e = &(*e)->next;
+            if (*e)
+               *e = f[k]->next;
+            free (f[k]);
          }
+         continue;
       }
-      free (filename);
-      if (!zap)
-      {                         // Don't retry for a bit
+      if (paused)
+      {                         // Partly sent, progress kept
+         ESP_LOGI (TAG, "Deferred %s part sent (%s)", f[0]->name, paused);
+         f[0]->deferred = paused;
+         paused = NULL;
+         continue;
+      }
+      for (int k = 0; k < n; k++)
+      {                         // Failed, others first, and fewer tries first next time
+         f[k]->tries++;
+         f[k]->deferred = "failed";
+      }
+      if (tried && response <= 0)
+      {                         // Server not there, don't retry for a bit
          delay = up + 60;
          ESP_LOGI (TAG, "No upload for 60 seconds");
-         return;
+         stopped = "no server";
+         break;
+      }
+   }
+   visitbytes += bytes;
+   visitus += esp_timer_get_time () - started;
+   struct
+   {
+      const char *why;
+      int count;
+   } deferred[8];
+   int reasons = 0;
+   for (upfile_t * u = upfiles; u; u = u->next)
+   {                            // Why each file not sent, kept until next session
+      if (!u->deferred)
+         u->deferred = stopped ? : "not sent";
+      int r;
+      for (r = 0; r < reasons && strcmp (deferred[r].why, u->deferred); r++);
+      if (r == reasons && reasons < sizeof (deferred) / sizeof (*deferred))
+      {
+         deferred[r].why = u->deferred;
+         deferred[r].count = 0;
+         reasons++;
+      }
+      if (r < reasons)
+         deferred[r].count++;
+   }
+   unfetch ();
+   if (client)
+   {
+      esp_http_client_close (client);
+      esp_http_client_cleanup (client);
+   }
+   free (buf);
+#undef	BLOCK
+   if (files || session.connects)
+   {                            // Session stats
+      uint32_t ms = (esp_timer_get_time () - started) / 1000;
+      jo_t j = jo_object_alloc ();
+      jo_int (j, "files", files);
+      jo_int (j, "bytes", bytes);
+      jo_litf (j, "seconds", "%lu.%03lu", ms / 1000, ms % 1000);
+      if (ms)
+         jo_litf (j, "perminute", "%.1f", files * 60000.0 / ms);
+      jo_int (j, "connections", session.connects);
+      if (dupes)
+         jo_int (j, "duplicates", dupes);
+      if (sdread_stats.reads)
+      {                         // Card reads, and how long sending waited for them
+         jo_litf (j, "readms", "%llu", sdread_stats.us / 1000);
+         jo_litf (j, "stallms", "%llu", sdread_stats.stallus / 1000);
       }
+      if (uploadbatch > 1)
+         jo_int (j, "batch", uploadbatch);
+      if (reasons)
+      {                         // Files not sent, by why
+         jo_object (j, "deferred");
+         for (int r = 0; r < reasons; r++)
+            jo_int (j, deferred[r].why, deferred[r].count);
+         jo_close (j);
+      }
+      revk_info ("Upload", &j);
    }
 }
 
@@ -1717,7 +2713,9 @@ sd_task (void *z)
       }
       wait (1);
       ESP_LOGI (TAG, "Mounting filesystem");
+      int64_t start = esp_timer_get_time ();
       ret = esp_vfs_fat_sdmmc_mount (sd_mount, &host, &slot, &mount_config, &card);
+      sdmountus = esp_timer_get_time () - start;
       if (ret != ESP_OK)
       {
          jo_t j = jo_object_alloc ();
@@ -1748,15 +2746,20 @@ sd_task (void *z)
       rgbsd = 'R';              // Oddly this call can hang forever!
       {
          esp_vfs_fat_info (sd_mount, &sdsize, &sdfree);
+         sdfreemount = sdfree;
          jo_t j = jo_object_alloc ();
          jo_string (j, "action", cardstatus = (b.doformat ? "Formatted" : "Mounted"));
          jo_int (j, "size", sdsize);
          jo_int (j, "free", sdfree);
+         jo_litf (j, "mount", "%lu.%03lu", sdmountus / 1000000UL, sdmountus / 1000UL % 1000UL);
          revk_info ("SD", &j);
       }
       rgbsd = 'Y';              // Mounted, ready
       b.doformat = 0;
       checkpostcode ();
+      sd_recover ();
+      sd_rawrecover ();
+      sd_migrate ();
       checkupload ();
       {                         // Check odometer
          FILE *o = fopen (odometer, "r");
@@ -1776,53 +2779,77 @@ sd_task (void *z)
          odonow = odostart;
          revk_command ("status", NULL);
       }
+      char *csvrows = NULL;     // CSV rows not yet written to card
+      size_t csvrowslen = 0;
+      FILE *csvrow = NULL;
       FILE *opencsv (int64_t now)
-      {
+      {                         // Rows are kept and written by csvflush, so one file open per journey rather than two per row
          if (!csvtime || csvtime > now || csvtime + 86400LL * 30LL * 1000000LL < now)
             csvtime = now;      // csvtime is in RTC memory so needs sanity check
-         char *ts = getts (csvtime, '-');
-         char filename[50];
-         sprintf (filename, "%s/%s.csv", sd_mount, ts);
-         free (ts);
-         FILE *o = fopen (filename, "r");
-         if (o)
-         {                      // Append
-            fclose (o);
-            o = fopen (filename, "a");
-         } else
-         {                      // Create
-            o = fopen (filename, "w");
-            if (o)
+         if (!csvrow)
+            csvrow = open_memstream (&csvrows, &csvrowslen);
+         return csvrow;
+      }
+      void csvflush (void)
+      {                         // Write CSV rows to card
+         if (!csvrow)
+            return;
+         fclose (csvrow);
+         csvrow = NULL;
+         if (csvrowslen)
+         {
+            char ts[30],
+              dir[20];
+            getts (ts, csvtime, '-');
+            char filename[60];
+            int64_t start = esp_timer_get_time ();
+            sprintf (filename, "%s/%s.csv", sd_dir (dir, ts), ts);
+            struct stat s;
+            uint8_t new = (stat (filename, &s) != 0);
+            FILE *o = fopen (filename, "a");
+            int64_t openus = esp_timer_get_time () - start;
+            if (!o)
             {
-               ESP_LOGI (TAG, "Open file %s", filename);
+               ESP_LOGE (TAG, "Failed open file %s", filename);
                jo_t j = jo_object_alloc ();
-               jo_string (j, "action", cardstatus = "CSV file created");
+               jo_string (j, "error", cardstatus = "Failed to create CSV file");
                jo_string (j, "filename", filename + sizeof (sd_mount));
-               revk_info ("SD", &j);
-               fprintf (o, "\"Time\",\"Latitude\",\"Longitude\",\"Odometer\"");
-               if (b.postcode)
-                  fprintf (o, ",\"Closest postcode\"");
-               fprintf (o, ",\"Distance\"\r\n");
+               revk_error ("SD", &j);
+            } else
+            {
+               if (new)
+               {
+                  ESP_LOGI (TAG, "Open file %s", filename);
+                  jo_t j = jo_object_alloc ();
+                  jo_string (j, "action", cardstatus = "CSV file created");
+                  jo_string (j, "filename", filename + sizeof (sd_mount));
+                  jo_litf (j, "open", "%lld.%03lld", openus / 1000LL, openus % 1000LL);        // ms
+                  revk_info ("SD", &j);
+                  fprintf (o, "\"Time\",\"Latitude\",\"Longitude\",\"Odometer\"");
+                  if (b.postcode)
+                     fprintf (o, ",\"Closest postcode\"");
+                  fprintf (o, ",\"Distance\"\r\n");
+               }
+               fwrite (csvrows, csvrowslen, 1, o);
+               upload_add (filename, ftell (o), NULL);     // Appended to, so hashed when sent
+               fclose (o);
             }
          }
-         if (!o)
-         {
-            ESP_LOGE (TAG, "Failed open file %s", filename);
-            jo_t j = jo_object_alloc ();
-            jo_string (j, "error", cardstatus = "Failed to create CSV file");
-            jo_string (j, "filename", filename + sizeof (sd_mount));
-            revk_error ("SD", &j);
-         }
-         return o;
+         free (csvrows);
+         csvrows = NULL;
+         csvrowslen = 0;
       }
       while (!b.doformat && !b.dodismount && !b.die)
       {
          FILE *o = NULL;
          int line = 0;
+         logbin_t binlog = { 0 };       // Binary log deltas
          char filename[100];
          uint64_t starttime = 0;
          uint64_t endtime = 0;
+         uint32_t synced = 0;
          uint8_t endhome = 0;
+         uint8_t raw = 0;       // Live journey in raw region, binary log made in to log file at end
          double endlat = NAN,
             endlon = NAN;
          while (!b.doformat && !b.dodismount)
@@ -1833,6 +2860,8 @@ sd_task (void *z)
                b.dodismount = 1;
                break;
             }
+            if (raw && lograw_left (o) < 16)
+               break;           // Region full, close, and next fix starts a new log
             fix_t *f = fixget (&fixsd);
             if (!f)
             {                   // End of queue
@@ -1853,14 +2882,22 @@ sd_task (void *z)
             }
             if (!o && f->sett && f->setecef && f->setlla && f->quality && b.moving)
             {                   // Open file
-               char *ts = getts (f->ecef.t, '-');
-               if (ts)
+               char ts[30];
+               if (getts (ts, f->ecef.t, '-'))
                {
                   char *postcode = getpostcode (f->lat, f->lon);
-                  sprintf (filename, "%s/%s.%s", sd_mount, ts, loggpx ? "gpx" : "json");
-                  free (ts);
-                  ts = getts (f->ecef.t, 0);
-                  o = fopen (filename, "w");
+                  sd_space ();
+                  int64_t start = esp_timer_get_time ();
+                  raw = (sdraw && !sd_rawrecover ());   // Not if a journey left in the region could not be made in to a log file
+                  if (raw && !(o = lograw_open (rawlog, sdraw * 1024 * 1024, LOGRAW_BLOCK)))
+                     raw = 0;   // Cannot make region, so normal log file
+                  uint8_t gzip = (sdsync && !raw ? 0 : loggzip);   // A checkpoint cannot be recovered from part of a gzip stream
+                  char dir[20];
+                  sprintf (filename, "%s/%s.%s%s", sd_dir (dir, ts), ts, loggpx ? "gpx" : logbin ? LOGBIN_EXT : "json", gzip ? LOGZ_EXT : "");
+                  getts (ts, f->ecef.t, 0);
+                  if (!raw)
+                     o = sdlog_open (filename, sdbuf * 1024, sdsync ? 0 : sdprealloc * 1024, gzip);     // Preallocated space would have to be cleared for recovery
+                  int64_t openus = esp_timer_get_time () - start;
                   if (!o)
                   {             // Open failed
                      ESP_LOGE (TAG, "Failed open file %s", filename);
@@ -1870,9 +2907,22 @@ sd_task (void *z)
                      revk_error ("SD", &j);
                   } else
                   {             // Open worked
+                     if (sdsync && !raw)
+                     {          // Note file being written, so recovered if not closed
+                        FILE *m = fopen (openlog, "w");
+                        if (m)
+                        {
+                           fprintf (m, "%s", filename);
+                           fflush (m);
+                           fsync (fileno (m));
+                           fclose (m);
+                        }
+                        synced = 0;
+                     }
                      if (b.sdempty)
                         csvtime = 0;
                      starttime = f->ecef.t;
+                     packreset = 1;
                      {
                         FILE *o = opencsv (starttime);
                         if (o)
@@ -1883,8 +2933,6 @@ sd_task (void *z)
                            if (b.postcode)
                               fprintf (o, ",\"%s\"", postcode ? : "");
                            fprintf (o, ",,\"Start\"\r\n");
-                           fclose (o);
-                           o = NULL;
                         }
                      }
                      b.sdempty = 0;
@@ -1895,13 +2943,13 @@ sd_task (void *z)
                      jo_t j = jo_object_alloc ();
                      jo_string (j, "action", cardstatus = "Log file created");
                      jo_string (j, "filename", filename + sizeof (sd_mount));
+                     jo_litf (j, "open", "%lld.%03lld", openus / 1000LL, openus % 1000LL);     // ms
+                     if (raw)
+                        jo_bool (j, "raw", 1);
                      revk_info ("SD", &j);
-                     if (loggpx)
+                     if (loggpx && !raw)
                      {
-                        fprintf (o, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n"    //
-                                 "<gpx version=\"1.0\">\r\n"    //
-                                 "<metadata><name>%s</name></metadata>\r\n"     //
-                                 "<trk><trkseg>\r\n", revk_id);
+                        fprintf (o, LOGGPX_HEAD "<metadata><name>%s</name></metadata>\r\n" LOGGPX_TRK, revk_id);
                      } else
                      {
                         jo_t j = jo_object_alloc ();
@@ -1923,54 +2971,53 @@ sd_task (void *z)
                            jo_array (j, "gps");
                         char *json = jo_finisha (&j);
                         int len = strlen (json);
-                        json[--len] = 0;
-                        if (logpos)
+                        if (logbin || raw)
+                        {       // Binary has whole object as start
+                           uint8_t h[6];
+                           fwrite (LOGBIN_MAGIC, sizeof (LOGBIN_MAGIC) - 1, 1, o);
+                           fwrite (h, logbin_header (h, LOGBIN_JSON, len), 1, o);
+                           fwrite (json, len, 1, o);
+                           memset (&binlog, 0, sizeof (binlog));
+                        } else
+                        {
                            json[--len] = 0;
-                        fprintf (o, "%s\r\n", json);
+                           if (logpos)
+                              json[--len] = 0;
+                           fprintf (o, "%s\r\n", json);
+                        }
                         free (json);
                      }
                   }
-                  free (ts);
                   free (postcode);
                   line = 0;
                }
             }
             if (o && logpos)
             {
-               if (loggpx)
+               if (loggpx && !raw)
                {
-                  if (f->setlla)
-                  {
-                     fprintf (o, "<trkpt lat=\"%.8lf\" lon=\"%.8lf\">", f->lat, f->lon);
-                     if (!isnan (f->alt))
-                        fprintf (o, "<ele>%.2f</ele>", f->alt);
-                     if (f->sett)
-                     {
-                        char *ts = getts (f->ecef.t, 0);
-                        if (ts)
-                           fprintf (o, "<time>%s</time>", ts);
-                        free (ts);
-                     }
-                     if (f->slow.fixmode >= 1)
-                        fprintf (o, "<fix>%s</fix>", f->slow.fixmode == 1 ? "none" : f->slow.fixmode == 2 ? "2d" : "3d");
-                     if (f->sats)
-                        fprintf (o, "<sat>%d</sat>", f->sats);
-                     if (!isnan (f->hdop) && f->hdop)
-                        fprintf (o, "<hdop>%.1f</hdop>", f->hdop);
-                     if (!isnan (f->slow.vdop) && f->slow.vdop)
-                        fprintf (o, "<vdop>%.1f</vdop>", f->slow.vdop);
-                     if (!isnan (f->slow.pdop) && f->slow.pdop)
-                        fprintf (o, "<pdop>%.1f</pdop>", f->slow.pdop);
-                     fprintf (o, "</trkpt>\r\n");
-                  }
+                  char l[LOGGPX_MAX];
+                  fwrite (l, loggpx_fix (l, sizeof (l), f, log_fields (), odoadjust, gpserrors), 1, o);
+                  gpserrors = 0;
+               } else if (logbin || raw)
+               {
+                  uint8_t rec[LOGBIN_MAX];
+                  fwrite (rec, logbin_fix (&binlog, rec, f, log_fields (), odoadjust, gpserrors), 1, o);
+                  gpserrors = 0;
                } else
                {
-                  jo_t j = log_line (f);
-                  char *l = jo_finisha (&j);
+                  char l[LOGJSON_MAX + 5],
+                   *p = l;
                   if (line++)
-                     fprintf (o, ",\r\n");
-                  fprintf (o, "  %s", l);
-                  free (l);
+                  {
+                     *p++ = ',';
+                     *p++ = '\r';
+                     *p++ = '\n';
+                  }
+                  *p++ = ' ';
+                  *p++ = ' ';
+                  p += log_line (p, LOGJSON_MAX, f);
+                  fwrite (l, p - l, 1, o);
                }
             }
             if (!f->waypoint)
@@ -1978,7 +3025,8 @@ sd_task (void *z)
             else if (!b.lastwaypoint && f->setlla && f->sett)
             {
                b.lastwaypoint = 1;
-               char *ts = getts (f->ecef.t, 0);
+               char ts[30];
+               getts (ts, f->ecef.t, 0);
                char *postcode = getpostcode (f->lat, f->lon);
                FILE *o = opencsv (starttime);
                if (o)
@@ -1992,9 +3040,7 @@ sd_task (void *z)
                   if (b.postcode)
                      fprintf (o, ",\"%s\"", postcode ? : "");
                   fprintf (o, ",,\"Waypoint\"\r\n");
-                  fclose (o);
                }
-               free (ts);
                free (postcode);
             }
             if (f->sett && f->setecef && f->setlla)
@@ -2004,6 +3050,15 @@ sd_task (void *z)
                endlat = f->lat;
                endlon = f->lon;
             }
+            if (o && sdsync && uptime () >= synced + sdsync)
+            {                   // Checkpoint
+               if (raw)
+                  lograw_sync (o);
+               else
+                  sdlog_sync (o);
+               csvflush ();
+               synced = uptime ();
+            }
             fixadd (&fixfree, f);       // Discard
          }
          if (o)
@@ -2015,18 +3070,17 @@ sd_task (void *z)
             // Postcode open is second file
             char *endpostcode = getpostcode (endlat, endlon);
             ESP_LOGE (TAG, "Close file");
-            if (loggpx)
-            {
-               fprintf (o, "</trkseg></trk>\r\n"        //
-                        "</gpx>\r\n");
-            } else
+            if (loggpx && !raw)
+               fprintf (o, LOGGPX_TRKEND LOGGPX_END);
+            else
             {
-               if (logpos)
+               if (logpos && !logbin && !raw)
                   fprintf (o, "\r\n ]");
                jo_t j = jo_object_alloc ();
                if (endtime)
                {
-                  char *ts = getts (endtime, 0);
+                  char ts[30];
+                  getts (ts, endtime, 0);
                   jo_object (j, "end");
                   jo_string (j, "ts", ts);
                   if (odonow >= ODOBASE)
@@ -2037,7 +3091,6 @@ sd_task (void *z)
                   if (endpostcode)
                      jo_string (j, "postcode", endpostcode);
                   jo_close (j);
-                  free (ts);
                }
                if (distance)
                   jo_litf (j, "distance", "%lld.%02lld", distance / 100LL, distance % 100LL);
@@ -2050,11 +3103,36 @@ sd_task (void *z)
                   if (logmph)
                      jo_litf (j, "mph", "%.1f", (float) speed / 16.09344);
                }
+               pack_stats (j);
+               if (raw)
+                  sd_stats (j, "raw", &lograw_stats);
+               else
+                  sd_stats (j, "sd", &sdlog_stats);
                char *json = jo_finisha (&j);
-               fprintf (o, ",\r\n%s\r\n", json + 1);
+               if (logbin || raw)
+               {                // Binary has whole object as end
+                  uint8_t h[6];
+                  int len = strlen (json);
+                  fwrite (h, logbin_header (h, LOGBIN_JSON, len), 1, o);
+                  fwrite (json, len, 1, o);
+               } else
+                  fprintf (o, ",\r\n%s\r\n", json + 1);
                free (json);
             }
             fclose (o);
+            unlink (openlog);
+            if (raw && sd_rawmake (filename) < 0)
+            {                   // Left in region, tried again before next journey, or at mount
+               jo_t j = jo_object_alloc ();
+               jo_string (j, "error", cardstatus = "Cannot make log file from live journey");
+               jo_string (j, "filename", filename + sizeof (sd_mount));
+               revk_error ("SD", &j);
+            } else
+            {
+               uint8_t sha256[SDLOG_SHA256];
+               upload_add (filename, sdlog_stats.bytes, sdlog_sha256 (sha256) ? NULL : sha256);
+            }
+            esp_vfs_fat_info (sd_mount, &sdsize, &sdfree);        // Free space trend
             if (distance)
             {                   // Odometer update
                FILE *o = fopen (odometer, "w");
@@ -2068,27 +3146,32 @@ sd_task (void *z)
             jo_t j = jo_object_alloc ();
             jo_string (j, "action", cardstatus = "Log file closed");
             jo_string (j, "filename", filename + sizeof (sd_mount));
+            pack_stats (j);
+            sd_stats (j, "sd", &sdlog_stats);
+            if (raw)
+               sd_stats (j, "raw", &lograw_stats);
             revk_info ("SD", &j);
             if (logcsv)
             {
                o = opencsv (starttime);
                if (o)
                {
-                  char *ts = getts (endtime, 0);
+                  char ts[30];
+                  getts (ts, endtime, 0);
                   fprintf (o, "%s,%.9lf,%.9lf,", ts, endlat, endlon);
                   if (odonow >= ODOBASE)
                      fprintf (o, "%lld.%02lld", odonow / 100LL, odonow % 100LL);
-                  free (ts);
                   if (b.postcode)
                      fprintf (o, ",\"%s\"", endpostcode ? : "");
                   fprintf (o, ",");
                   if (distance)
                      fprintf (o, "%lld.%02lld", distance / 100, distance % 100);
                   fprintf (o, ",\"End\"\r\n\r\n");
-                  fclose (o);
                }
+               o = NULL;
                free (endpostcode);
             }
+            csvflush ();
             odostart = odonow;  // next journey
          }
          checkupload ();
@@ -2096,6 +3179,7 @@ sd_task (void *z)
       rgbsd = 'B';
       // All done, unmount partition and disable SPI peripheral
       esp_vfs_fat_sdcard_unmount (sd_mount, card);
+      upload_clear ();
       ESP_LOGI (TAG, "Card dismounted");
       {
          jo_t j = jo_object_alloc ();
@@ -2282,6 +3366,8 @@ revk_state_extra (jo_t j)
       jo_string (j, "SD", cardstatus);
    if (b.sdpresent && sdsize)
       jo_int (j, "sdsize", sdsize);
+   if (b.sdpresent)
+      sd_stats (j, "sdio", &sdlog_total);
    if (b.charging)
       jo_bool (j, "charging", 1);
    if (b.usb)
@@ -2343,6 +3429,7 @@ app_main ()
          revk_task ("RGB", rgb_task, NULL, 4);
    }
    // Main task...
+   fixms = fixwant = gpsfixms;
    revk_gpio_input (gpstick);
    gps_connect (gpsbaud);
    acc_init ();
@@ -2366,6 +3453,12 @@ app_main ()
       uint32_t up = uptime ();
       if (b.gpsinit)
          gps_init ();
+      if (b.gpsstarted && fixwant && fixwant != fixms)
+      {                         // Adaptive fix rate change
+         fixms = fixwant;
+         gps_cmd ("$PMTK220,%d", fixms);
+         gps_cmd ("$PMTK414");  // Q_NMEA_OUTPUT, response sets message rates for new fix rate
+      }
       if (b.moving)
          busy = up;
       if (revk_gpio_get (button))
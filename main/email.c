@@ -48,6 +48,9 @@ extern uint8_t upload;
 static const char *TAG = "Email";
 
 #define BUF_SIZE            512
+#define DATA_SIZE           16384       // File sent at a time, a whole TLS record
+#define	LINE_RAW	57      // File bytes per base64 line, 76 characters
+#define	LINE_SIZE	(LINE_RAW/3*4+2)        // Base64 line with CRLF
 
 #define VALIDATE_MBEDTLS_RETURN(ret, min_valid_ret, max_valid_ret, goto_label)  \
     do {                                                                        \
@@ -206,9 +209,13 @@ write_ssl_data (mbedtls_ssl_context * ssl, unsigned char *buf, size_t len)
    if (len)
       ESP_LOGD (TAG, "%s", buf);
 
-   while (len && (ret = mbedtls_ssl_write (ssl, buf, len)) <= 0)
+   while (len)
    {
-      if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+      if ((ret = mbedtls_ssl_write (ssl, buf, len)) > 0)
+      {                         // May be less than len, e.g. more than a TLS record
+         buf += ret;
+         len -= ret;
+      } else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
       {
          ESP_LOGE (TAG, "mbedtls_ssl_write failed with error -0x%x", -ret);
          return ret;
@@ -261,7 +268,8 @@ perform_tls_handshake (mbedtls_ssl_context * ssl)
 }
 
 int
-email_send (const char *emailto, const char *contenttype, const char *filename, const char *subject, FILE * i, int filelen)
+email_send (const char *emailto, const char *contenttype, const char *filename, const char *subject, const char *digest, FILE * i,
+            int filelen)
 {
    if (!*emailhost)
       return 599;
@@ -425,21 +433,53 @@ email_send (const char *emailto, const char *contenttype, const char *filename,
                    "MIME-Version: 1.0\r\n"      //
                    "Content-Type: %s\r\n"       // 
                    "Content-Disposition: attachment;filename=%s;\r\n"   //
-                   "\r\n", hostname, emailfrom, subject, emailto, contenttype, filename);
+                   "Content-Transfer-Encoding: base64\r\n"     // So any bytes, and no lines of just a dot or too long
+                   "%s%s%s"     // Repr-Digest, if known
+                   "\r\n", hostname, emailfrom, subject, emailto, contenttype, filename, *digest ? "Repr-Digest: " : "", digest,
+                   *digest ? "\r\n" : "");
 
    ret = write_ssl_data (&ssl, (unsigned char *) buf, len);
    int total = 0;
+   int lines = DATA_SIZE / LINE_SIZE;   // Base64 lines per write
+   char *data = mallocspi (lines * LINE_SIZE);
+   char *raw = mallocspi (lines * LINE_RAW);
+   if (!data || !raw)
+   {                            // Not ideal, but carry on with small buffer
+      free (data);
+      free (raw);
+      lines = BUF_SIZE / LINE_SIZE;
+      data = (char *) buf;
+      raw = mallocspi (lines * LINE_RAW);
+      if (!raw)
+         ret = -1;
+   }
    while (!ret)
    {
-      len = fread (buf, 1, BUF_SIZE, i);
+      len = fread (raw, 1, lines * LINE_RAW, i);
       if (len <= 0)
          break;
       total += len;
       upload = total * 100 / filelen;
-      ret = write_ssl_data (&ssl, (unsigned char *) buf, len);
+      size_t out = 0;
+      for (int p = 0; !ret && p < len; p += LINE_RAW)
+      {                         // Base64 lines
+         size_t l = 0;
+         ret = mbedtls_base64_encode ((unsigned char *) data + out, LINE_SIZE + 1, &l, (unsigned char *) raw + p,
+                                      len - p < LINE_RAW ? len - p : LINE_RAW);
+         out += l;
+         data[out++] = '\r';
+         data[out++] = '\n';
+      }
+      if (!ret)
+         ret = write_ssl_data (&ssl, (unsigned char *) data, out);
    }
+   if (data != (char *) buf)
+      free (data);
+   free (raw);
 
-   len = snprintf ((char *) buf, BUF_SIZE, "\r\n.\r\n");
+   if (ret)
+      goto exit;                // Do not end message if not all sent
+   len = snprintf ((char *) buf, BUF_SIZE, ".\r\n");    // Base64 ends with CRLF
    ret = write_ssl_and_get_response (&ssl, (unsigned char *) buf, len);
    VALIDATE_MBEDTLS_RETURN (ret, 200, 299, exit);
    ESP_LOGI (TAG, "Email sent, ret=%d", ret);
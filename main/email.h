@@ -1 +1 @@
-int email_send(const char *emailto,const char *contenttype,const char *filename,const char *subject,FILE *i,int filelen);
+int email_send(const char *emailto,const char *contenttype,const char *filename,const char *subject,const char *digest,FILE *i,int filelen);
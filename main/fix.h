@@ -0,0 +1,70 @@
+// GPS logger fix data, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+
+#ifndef	FIX_H
+#define	FIX_H
+
+#include <stdint.h>
+
+#define	SYSTEMS	3
+#define	ODOBASE	10000000000     // cm
+
+typedef struct slow_s slow_t;
+struct slow_s
+{                               // Slow updated data
+   uint8_t gsv[SYSTEMS];        // Sats in view
+   uint8_t gsa[SYSTEMS];        // Sats active
+   uint8_t fixmode;             // Fix mode from slow update, 1=none, 2=2d, 3=3d
+   float course;
+   float speed;
+   float hdop;                  // Slow hdop
+   float pdop;
+   float vdop;
+};
+
+typedef struct fix_s fix_t;
+struct fix_s
+{                               // each fix
+   fix_t *next;                 // Next in queue
+   uint32_t seq;                // Simple sequence number
+   struct
+   {                            // Earth centred Earth fixed, used for packing, etc, and time stamp (us)
+      int64_t x,
+        y,
+        z,
+        t;
+   } ecef;
+   slow_t slow;
+   uint64_t odo;                // Odometer
+   double lat,
+     lon;
+   float alt;
+   float und;
+   float hdop;
+   float hepe;                  // Estimated position error
+   float vepe;
+   float dsq;                   // Square of deviation from line from packing
+   struct acc
+   {                            // Acc data
+      float x,
+        y,
+        z;
+   } acc;
+   uint8_t quality;             // Fix quality (0=none, 1=GPS, 2=SBAS)
+   uint8_t sats;                // Sats used for fix
+   uint8_t accmove:1;           // Acc G level for move
+   uint8_t acccrash:1;          // Acc G level for crascrash
+   uint8_t waypoint:1;          // Log a waypoint
+   uint8_t home:1;              // This pos is at home
+   uint8_t corner:1;            // Corner point for packing
+   uint8_t deleted:1;           // Deleted by packing
+   uint8_t sett:1;              // Fields set
+   uint8_t setsat:1;
+   uint8_t setecef:1;
+   uint8_t setlla:1;
+   uint8_t setepe:1;
+   uint8_t setodo:1;
+   uint8_t setacc:1;
+};
+
+#endif
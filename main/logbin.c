@@ -0,0 +1,331 @@
+// GPS logger compact binary log format, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+// A fix record is a varint of present fields (LOGBIN_P_...), then each present field in order...
+// - TS         Time, signed delta from previous (us)
+// - SEQ        Sequence, delta from previous
+// - SATS       NAVSTAR, GLONASS, GALILEO active, and sats used
+// - FIXMODE    Byte
+// - LLA        Lat and lon, signed delta from previous (1e-8 degrees), and quality byte
+// - ALT        Signed delta from previous (cm)
+// - UND        Signed (cm)
+// - HEPE, VEPE cm
+// - HDOP, PDOP, VDOP 0.1
+// - SPEED, COURSE 0.01 kph and degrees (speed also present if MPH, which has no data of its own)
+// - ECEF       X, Y, Z signed delta from previous (um, or mm if ECEFMM)
+// - ACC        X, Y, Z signed (mG), (ACCMOVE and ACCCRASH have no data)
+// - DSQ        4 byte LE float
+// - ODO        Delta from previous (cm, includes any adjustment)
+// - ERRORS     Count
+// (HOME and WAYPOINT have no data)
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "logbin.h"
+
+static uint8_t *
+put (uint8_t * p, uint64_t v)
+{                               // Varint
+   while (v >= 0x80)
+   {
+      *p++ = (v | 0x80);
+      v >>= 7;
+   }
+   *p++ = v;
+   return p;
+}
+
+static uint8_t *
+puts64 (uint8_t * p, int64_t v)
+{                               // Zigzag
+   return put (p, ((uint64_t) v << 1) ^ (uint64_t) (v >> 63));
+}
+
+static uint64_t
+get (const uint8_t ** pp, const uint8_t * e)
+{
+   const uint8_t *p = *pp;
+   uint64_t v = 0;
+   int s = 0;
+   while (p < e && s < 64)
+   {
+      v |= (uint64_t) (*p & 0x7F) << s;
+      s += 7;
+      if (!(*p++ & 0x80))
+         break;
+   }
+   *pp = p;
+   return v;
+}
+
+static int64_t
+gets64 (const uint8_t ** pp, const uint8_t * e)
+{
+   uint64_t v = get (pp, e);
+   return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+int
+logbin_header (uint8_t * buf, uint8_t type, int len)
+{                               // Record header
+   uint8_t *p = buf;
+   *p++ = type;
+   p = put (p, len);
+   return p - buf;
+}
+
+int
+logbin_fix (logbin_t * s, uint8_t * buf, fix_t * f, uint32_t fields, int64_t odoadjust, uint8_t errors)
+{                               // Fix record, fields present as per log_line
+   uint32_t m = 0;
+   uint8_t fixmode = f->slow.fixmode;
+   uint8_t speed = (f->quality && !isnan (f->slow.speed) && f->slow.speed != 0);
+   if (f->sett)
+      m |= LOGBIN_P_TS;
+   if (fields & LOGBIN_SEQ)
+      m |= LOGBIN_P_SEQ;
+   if ((fields & LOGBIN_SATS) && f->sats + f->slow.gsa[0] + f->slow.gsa[1] + f->slow.gsa[2])
+      m |= LOGBIN_P_SATS;
+   if (fixmode)
+      m |= LOGBIN_P_FIXMODE;
+   if ((fields & LOGBIN_LLA) && f->setlla && f->quality)
+   {
+      m |= LOGBIN_P_LLA;
+      if (fixmode >= 3 && !isnan (f->alt))
+         m |= LOGBIN_P_ALT;
+   }
+   if ((fields & LOGBIN_UND) && fixmode >= 3 && !isnan (f->und))
+      m |= LOGBIN_P_UND;
+   if ((fields & LOGBIN_EPE) && f->setepe && fixmode >= 1)
+   {
+      if (f->hepe > 0)
+         m |= LOGBIN_P_HEPE;
+      if (f->vepe > 0 && fixmode >= 3)
+         m |= LOGBIN_P_VEPE;
+   }
+   if (fields & LOGBIN_DOP)
+   {
+      if (!isnan (f->hdop) && f->hdop)
+         m |= LOGBIN_P_HDOP;
+      if (!isnan (f->slow.pdop) && f->slow.pdop)
+         m |= LOGBIN_P_PDOP;
+      if (!isnan (f->slow.vdop) && f->slow.vdop && fixmode >= 3)
+         m |= LOGBIN_P_VDOP;
+   }
+   if ((fields & LOGBIN_CS) && speed)
+   {
+      m |= LOGBIN_P_SPEED;
+      if (!isnan (f->slow.course))
+         m |= LOGBIN_P_COURSE;
+   }
+   if ((fields & LOGBIN_MPH) && speed)
+      m |= LOGBIN_P_MPH;
+   if (f->setecef && (fields & LOGBIN_ECEF))
+   {
+      m |= LOGBIN_P_ECEF;
+      if (!((f->ecef.x - s->x) % 1000) && !((f->ecef.y - s->y) % 1000) && !((f->ecef.z - s->z) % 1000))
+         m |= LOGBIN_P_ECEFMM;
+   }
+   if (f->setacc && (fields & LOGBIN_ACC))
+   {
+      m |= LOGBIN_P_ACC;
+      if (f->accmove)
+         m |= LOGBIN_P_ACCMOVE;
+      if (f->acccrash)
+         m |= LOGBIN_P_ACCCRASH;
+   }
+   if ((fields & LOGBIN_DSQ) && !isnan (f->dsq))
+      m |= LOGBIN_P_DSQ;
+   if ((fields & LOGBIN_ODO) && f->setodo && f->odo >= ODOBASE)
+      m |= LOGBIN_P_ODO;
+   if (errors)
+      m |= LOGBIN_P_ERRORS;
+   if (f->home && f->setecef)
+      m |= LOGBIN_P_HOME;
+   if (f->waypoint)
+      m |= LOGBIN_P_WAYPOINT;
+   // Data, after header, which is at most 3 bytes for LOGBIN_MAX
+   uint8_t data[LOGBIN_MAX - 3],
+    *p = data;
+   p = put (p, m);
+   if (m & LOGBIN_P_TS)
+   {
+      p = puts64 (p, f->ecef.t - s->t);
+      s->t = f->ecef.t;
+   }
+   if (m & LOGBIN_P_SEQ)
+   {
+      p = put (p, f->seq - s->seq);
+      s->seq = f->seq;
+   }
+   if (m & LOGBIN_P_SATS)
+   {
+      for (int i = 0; i < SYSTEMS; i++)
+         p = put (p, f->slow.gsa[i]);
+      p = put (p, f->sats);
+   }
+   if (m & LOGBIN_P_FIXMODE)
+      *p++ = fixmode;
+   if (m & LOGBIN_P_LLA)
+   {
+      int64_t lat = llround (f->lat * 100000000.0);
+      int64_t lon = llround (f->lon * 100000000.0);
+      p = puts64 (p, lat - s->lat);
+      p = puts64 (p, lon - s->lon);
+      s->lat = lat;
+      s->lon = lon;
+      *p++ = f->quality;
+   }
+   if (m & LOGBIN_P_ALT)
+   {
+      int32_t alt = lroundf (f->alt * 100);
+      p = puts64 (p, alt - s->alt);
+      s->alt = alt;
+   }
+   if (m & LOGBIN_P_UND)
+      p = puts64 (p, lroundf (f->und * 100));
+   if (m & LOGBIN_P_HEPE)
+      p = put (p, lroundf (f->hepe * 100));
+   if (m & LOGBIN_P_VEPE)
+      p = put (p, lroundf (f->vepe * 100));
+   if (m & LOGBIN_P_HDOP)
+      p = put (p, lroundf (f->hdop * 10));
+   if (m & LOGBIN_P_PDOP)
+      p = put (p, lroundf (f->slow.pdop * 10));
+   if (m & LOGBIN_P_VDOP)
+      p = put (p, lroundf (f->slow.vdop * 10));
+   if (m & (LOGBIN_P_SPEED | LOGBIN_P_MPH))
+      p = put (p, lroundf (f->slow.speed * 100));
+   if (m & LOGBIN_P_COURSE)
+      p = put (p, lroundf (f->slow.course * 100));
+   if (m & LOGBIN_P_ECEF)
+   {
+      int d = ((m & LOGBIN_P_ECEFMM) ? 1000 : 1);
+      p = puts64 (p, (f->ecef.x - s->x) / d);
+      p = puts64 (p, (f->ecef.y - s->y) / d);
+      p = puts64 (p, (f->ecef.z - s->z) / d);
+      s->x = f->ecef.x;
+      s->y = f->ecef.y;
+      s->z = f->ecef.z;
+   }
+   if (m & LOGBIN_P_ACC)
+   {
+      p = puts64 (p, lroundf (f->acc.x * 1000));
+      p = puts64 (p, lroundf (f->acc.y * 1000));
+      p = puts64 (p, lroundf (f->acc.z * 1000));
+   }
+   if (m & LOGBIN_P_DSQ)
+   {
+      uint32_t v;
+      memcpy (&v, &f->dsq, 4);
+      for (int i = 0; i < 4; i++)
+         *p++ = v >> (i * 8);
+   }
+   if (m & LOGBIN_P_ODO)
+   {
+      uint64_t odo = f->odo + odoadjust;
+      p = put (p, odo - s->odo);
+      s->odo = odo;
+   }
+   if (m & LOGBIN_P_ERRORS)
+      p = put (p, errors);
+   int h = logbin_header (buf, LOGBIN_FIX, p - data);
+   memcpy (buf + h, data, p - data);
+   return h + (p - data);
+}
+
+uint32_t
+logbin_decode (logbin_t * s, const uint8_t * data, int len, fix_t * f, uint8_t * errors)
+{                               // Decode fix record data
+   const uint8_t *p = data,
+      *e = data + len;
+   memset (f, 0, sizeof (*f));
+   f->alt = f->und = f->hdop = f->hepe = f->vepe = f->dsq = NAN;
+   f->slow.pdop = f->slow.vdop = f->slow.speed = f->slow.course = NAN;
+   if (errors)
+      *errors = 0;
+   uint32_t m = get (&p, e);
+   if (m & LOGBIN_P_TS)
+   {
+      f->ecef.t = s->t += gets64 (&p, e);
+      f->sett = 1;
+   }
+   if (m & LOGBIN_P_SEQ)
+      f->seq = s->seq += get (&p, e);
+   if (m & LOGBIN_P_SATS)
+   {
+      for (int i = 0; i < SYSTEMS; i++)
+         f->slow.gsa[i] = get (&p, e);
+      f->sats = get (&p, e);
+      f->setsat = 1;
+   }
+   if ((m & LOGBIN_P_FIXMODE) && p < e)
+      f->slow.fixmode = *p++;
+   if (m & LOGBIN_P_LLA)
+   {
+      s->lat += gets64 (&p, e);
+      s->lon += gets64 (&p, e);
+      f->lat = s->lat / 100000000.0;
+      f->lon = s->lon / 100000000.0;
+      if (p < e)
+         f->quality = *p++;
+      f->setlla = 1;
+   }
+   if (m & LOGBIN_P_ALT)
+      f->alt = (s->alt += gets64 (&p, e)) / 100.0;
+   if (m & LOGBIN_P_UND)
+      f->und = gets64 (&p, e) / 100.0;
+   if (m & LOGBIN_P_HEPE)
+      f->hepe = get (&p, e) / 100.0;
+   if (m & LOGBIN_P_VEPE)
+      f->vepe = get (&p, e) / 100.0;
+   if (m & (LOGBIN_P_HEPE | LOGBIN_P_VEPE))
+      f->setepe = 1;
+   if (m & LOGBIN_P_HDOP)
+      f->hdop = get (&p, e) / 10.0;
+   if (m & LOGBIN_P_PDOP)
+      f->slow.pdop = get (&p, e) / 10.0;
+   if (m & LOGBIN_P_VDOP)
+      f->slow.vdop = get (&p, e) / 10.0;
+   if (m & (LOGBIN_P_SPEED | LOGBIN_P_MPH))
+      f->slow.speed = get (&p, e) / 100.0;
+   if (m & LOGBIN_P_COURSE)
+      f->slow.course = get (&p, e) / 100.0;
+   if (m & LOGBIN_P_ECEF)
+   {
+      int d = ((m & LOGBIN_P_ECEFMM) ? 1000 : 1);
+      f->ecef.x = s->x += gets64 (&p, e) * d;
+      f->ecef.y = s->y += gets64 (&p, e) * d;
+      f->ecef.z = s->z += gets64 (&p, e) * d;
+      f->setecef = 1;
+   }
+   if (m & LOGBIN_P_ACC)
+   {
+      f->acc.x = gets64 (&p, e) / 1000.0;
+      f->acc.y = gets64 (&p, e) / 1000.0;
+      f->acc.z = gets64 (&p, e) / 1000.0;
+      f->accmove = ((m & LOGBIN_P_ACCMOVE) ? 1 : 0);
+      f->acccrash = ((m & LOGBIN_P_ACCCRASH) ? 1 : 0);
+      f->setacc = 1;
+   }
+   if ((m & LOGBIN_P_DSQ) && p + 4 <= e)
+   {
+      uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+      memcpy (&f->dsq, &v, 4);
+      p += 4;
+   }
+   if (m & LOGBIN_P_ODO)
+   {
+      f->odo = s->odo += get (&p, e);
+      f->setodo = 1;
+   }
+   if (m & LOGBIN_P_ERRORS)
+   {
+      uint8_t n = get (&p, e);
+      if (errors)
+         *errors = n;
+   }
+   f->home = ((m & LOGBIN_P_HOME) ? 1 : 0);
+   f->waypoint = ((m & LOGBIN_P_WAYPOINT) ? 1 : 0);
+   return m;
+}
@@ -0,0 +1,81 @@
+// GPS logger compact binary log format, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+
+// File is LOGBIN_MAGIC, then records, each a type byte, a varint length, and data
+// Integers are varint (7 bits per byte, LS first, top bit set if more), signed are zigzag encoded
+
+#ifndef	LOGBIN_H
+#define	LOGBIN_H
+
+#include "fix.h"
+
+#define	LOGBIN_MAGIC	"GPSB\001"      // Magic and version
+#define	LOGBIN_EXT	"gpsb"  // File extension
+#define	LOGBIN_JSON	'J'     // JSON object text, start info first (with empty gps array if positions logged) and end info last
+#define	LOGBIN_FIX	'F'     // Fix, see logbin.c
+#define	LOGBIN_MAX	200     // Max record length (fix)
+
+enum
+{                               // Fields to log, as log settings
+   LOGBIN_SEQ = (1 << 0),
+   LOGBIN_SATS = (1 << 1),
+   LOGBIN_LLA = (1 << 2),
+   LOGBIN_UND = (1 << 3),
+   LOGBIN_EPE = (1 << 4),
+   LOGBIN_DOP = (1 << 5),
+   LOGBIN_CS = (1 << 6),
+   LOGBIN_MPH = (1 << 7),
+   LOGBIN_ECEF = (1 << 8),
+   LOGBIN_ACC = (1 << 9),
+   LOGBIN_DSQ = (1 << 10),
+   LOGBIN_ODO = (1 << 11),
+};
+
+enum
+{                               // Fields present in a fix record
+   LOGBIN_P_TS = (1 << 0),
+   LOGBIN_P_SEQ = (1 << 1),
+   LOGBIN_P_SATS = (1 << 2),
+   LOGBIN_P_FIXMODE = (1 << 3),
+   LOGBIN_P_LLA = (1 << 4),
+   LOGBIN_P_ALT = (1 << 5),
+   LOGBIN_P_UND = (1 << 6),
+   LOGBIN_P_HEPE = (1 << 7),
+   LOGBIN_P_VEPE = (1 << 8),
+   LOGBIN_P_HDOP = (1 << 9),
+   LOGBIN_P_PDOP = (1 << 10),
+   LOGBIN_P_VDOP = (1 << 11),
+   LOGBIN_P_SPEED = (1 << 12),
+   LOGBIN_P_COURSE = (1 << 13),
+   LOGBIN_P_MPH = (1 << 14),
+   LOGBIN_P_ECEF = (1 << 15),
+   LOGBIN_P_ECEFMM = (1 << 16),
+   LOGBIN_P_ACC = (1 << 17),
+   LOGBIN_P_ACCMOVE = (1 << 18),
+   LOGBIN_P_ACCCRASH = (1 << 19),
+   LOGBIN_P_DSQ = (1 << 20),
+   LOGBIN_P_ODO = (1 << 21),
+   LOGBIN_P_ERRORS = (1 << 22),
+   LOGBIN_P_HOME = (1 << 23),
+   LOGBIN_P_WAYPOINT = (1 << 24),
+};
+
+typedef struct logbin_s logbin_t;
+struct logbin_s
+{                               // Previous values for deltas, zero at start of file
+   uint32_t seq;
+   int64_t t,
+     x,
+     y,
+     z;
+   int64_t lat,
+     lon;
+   int32_t alt;
+   uint64_t odo;
+};
+
+int logbin_header (uint8_t * buf, uint8_t type, int len);       // Make record header in buf (at least 6 bytes), return length
+int logbin_fix (logbin_t * s, uint8_t * buf, fix_t * f, uint32_t fields, int64_t odoadjust, uint8_t errors);       // Make fix record in buf (LOGBIN_MAX), return length
+uint32_t logbin_decode (logbin_t * s, const uint8_t * data, int len, fix_t * f, uint8_t * errors);  // Decode fix record data in to f, return present fields
+
+#endif
@@ -0,0 +1,156 @@
+// GPS logger binary log conversion to JSON or GPX, as would have been written, or binary with an end added if missing, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+// Used by gpsbin, and on device to make the log file from the live journey in raw mode
+
+#include <stdlib.h>
+#include <string.h>
+#include "logconv.h"
+
+uint32_t
+logconv_fields (uint32_t m)
+{                               // Fields logged, from fields present
+   return ((m & LOGBIN_P_SEQ) ? LOGBIN_SEQ : 0) | ((m & LOGBIN_P_SATS) ? LOGBIN_SATS : 0) | ((m & LOGBIN_P_LLA) ? LOGBIN_LLA : 0) |
+      ((m & LOGBIN_P_UND) ? LOGBIN_UND : 0) | ((m & (LOGBIN_P_HEPE | LOGBIN_P_VEPE)) ? LOGBIN_EPE : 0) |
+      ((m & (LOGBIN_P_HDOP | LOGBIN_P_PDOP | LOGBIN_P_VDOP)) ? LOGBIN_DOP : 0) | ((m & LOGBIN_P_SPEED) ? LOGBIN_CS : 0) |
+      ((m & LOGBIN_P_MPH) ? LOGBIN_MPH : 0) | ((m & LOGBIN_P_ECEF) ? LOGBIN_ECEF : 0) | ((m & LOGBIN_P_ACC) ? LOGBIN_ACC : 0) |
+      ((m & LOGBIN_P_DSQ) ? LOGBIN_DSQ : 0) | ((m & LOGBIN_P_ODO) ? LOGBIN_ODO : 0);
+}
+
+char *
+logconv_jsonstr (const char *json, const char *tag)
+{                               // Simple top level string from JSON object as made on device
+   char find[50];
+   snprintf (find, sizeof (find), "\"%s\":\"", tag);
+   const char *p = strstr (json, find);
+   if (!p)
+      return NULL;
+   p += strlen (find);
+   const char *e = p;
+   while (*e && *e != '"')
+      e += (*e == '\\' && e[1]) ? 2 : 1;
+   return strndup (p, e - p);
+}
+
+int
+logconv (FILE * i, FILE * o, uint8_t format)
+{                               // Binary to JSON or GPX, as device would have written, or binary as is
+   char magic[sizeof (LOGBIN_MAGIC) - 1];
+   if (fread (magic, sizeof (magic), 1, i) != 1 || memcmp (magic, LOGBIN_MAGIC, sizeof (magic)))
+      return -1;
+   if (format == LOGCONV_BIN)
+      fwrite (magic, sizeof (magic), 1, o);
+   logbin_t s = { 0 };
+   int line = 0;
+   int json = 0;                // JSON records seen, first is start, second is end
+   uint8_t gps = 0;             // JSON start has gps array
+   fix_t last = { 0 };          // Last fix with position, for end if recovered
+   int c;
+   uint8_t *data = NULL;
+   while (json < 2 && (c = fgetc (i)) != EOF)
+   {
+      uint32_t len = 0;
+      int shift = 0,
+         b;
+      while ((b = fgetc (i)) != EOF && shift < 28)
+      {
+         len |= (uint32_t) (b & 0x7F) << shift;
+         shift += 7;
+         if (!(b & 0x80))
+            break;
+      }
+      if (b == EOF || (b & 0x80) || len > 100000)
+         break;                 // Bad record
+      uint8_t *d = realloc (data, len + 1);
+      if (!d)
+         break;
+      data = d;
+      if (fread (data, 1, len, i) != len)
+         break;                 // Truncated
+      data[len] = 0;
+      if (c == LOGBIN_JSON)
+         json++;
+      else if (c != LOGBIN_FIX || json != 1)
+         continue;
+      if (format == LOGCONV_BIN)
+      {                         // As is
+         uint8_t h[6];
+         fwrite (h, logbin_header (h, c, len), 1, o);
+         fwrite (data, len, 1, o);
+      }
+      if (c == LOGBIN_FIX)
+      {
+         fix_t f;
+         uint8_t errors = 0;
+         uint32_t m = logbin_decode (&s, data, len, &f, &errors);
+         if (f.sett && f.setlla)
+            last = f;
+         if (format == LOGCONV_GPX)
+         {
+            char l[LOGGPX_MAX];
+            fwrite (l, loggpx_fix (l, sizeof (l), &f, logconv_fields (m), 0, errors), 1, o);
+         } else if (format == LOGCONV_JSON)
+         {
+            char l[LOGJSON_MAX];
+            logjson_fix (l, sizeof (l), &f, logconv_fields (m), 0, errors);
+            if (line++)
+               fprintf (o, ",\r\n");
+            fprintf (o, "  %s", l);
+         }
+         continue;
+      }
+      char *j = (char *) data;
+      if (json == 1)
+      {                         // Start
+         if (len >= 3 && !strcmp (j + len - 3, "[]}"))
+         {
+            gps = 1;
+            len -= 2;
+         } else if (len)
+            len--;
+         if (format == LOGCONV_GPX)
+         {
+            char *id = logconv_jsonstr (j, "id");
+            fprintf (o, LOGGPX_HEAD "<metadata><name>%s</name></metadata>\r\n" LOGGPX_TRK, id ? : "");
+            free (id);
+         } else if (format == LOGCONV_JSON)
+            fprintf (o, "%.*s\r\n", (int) len, j);
+      } else if (format == LOGCONV_GPX)
+         fprintf (o, LOGGPX_TRKEND LOGGPX_END);
+      else if (format == LOGCONV_JSON)
+      {                         // End
+         if (gps)
+            fprintf (o, "\r\n ]");
+         fprintf (o, ",\r\n%s\r\n", j + 1);
+      }
+   }
+   free (data);
+   if (json >= 2)
+      return 0;
+   if (!json)
+      return -1;                // Not even a start
+   // No end, so make one
+   if (format == LOGCONV_GPX)
+      fprintf (o, LOGGPX_TRKEND LOGGPX_END);
+   else
+   {
+      char end[150],
+        ts[30];
+      int len = 0;
+      if (last.setlla && logjson_ts (ts, last.ecef.t))
+         len = snprintf (end, sizeof (end), "{\"end\":{\"ts\":\"%s\",\"lat\":%.9lf,\"lon\":%.9lf},\"recovered\":true}", ts, last.lat, last.lon);
+      else
+         len = snprintf (end, sizeof (end), "{\"recovered\":true}");
+      if (format == LOGCONV_BIN)
+      {
+         uint8_t h[6];
+         fwrite (h, logbin_header (h, LOGBIN_JSON, len), 1, o);
+         fwrite (end, len, 1, o);
+      } else
+      {
+         if (gps)
+            fprintf (o, "\r\n ]");
+         fprintf (o, ",\r\n%s\r\n", end + 1);
+      }
+   }
+   return 1;
+}
@@ -0,0 +1,18 @@
+// GPS logger binary log conversion to JSON or GPX, as would have been written, or binary with an end added if missing, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+
+#ifndef	LOGCONV_H
+#define	LOGCONV_H
+
+#include <stdio.h>
+#include "loggpx.h"
+
+#define	LOGCONV_JSON	0       // Formats
+#define	LOGCONV_GPX	1
+#define	LOGCONV_BIN	2       // Records as is, so only adds the end if missing
+
+uint32_t logconv_fields (uint32_t m);   // Fields logged (LOGBIN_*), from fields present in a fix record (LOGBIN_P_*)
+char *logconv_jsonstr (const char *json, const char *tag);      // Malloc'd top level string from JSON object as made on device, NULL if not found
+int logconv (FILE * i, FILE * o, uint8_t format);       // Binary log to format, return 0 if complete, 1 if no end (end added, with "recovered":true), -1 if not a binary log
+
+#endif
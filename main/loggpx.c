@@ -0,0 +1,132 @@
+// GPS logger GPX log track points, written straight in to a buffer, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+// The standard elements are as the GPX log always had, the extensions carry what the JSON log has, for the same log settings
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include "loggpx.h"
+
+typedef struct out_s out_t;
+struct out_s
+{
+   char *p;                     // Next
+   char *e;                     // End (space for null)
+};
+
+static void
+add (out_t * o, const char *fmt, ...)
+{
+   va_list ap;
+   va_start (ap, fmt);
+   int l = vsnprintf (o->p, o->e - o->p + 1, fmt, ap);
+   va_end (ap);
+   if (l > 0)
+      o->p += (l < o->e - o->p ? l : o->e - o->p);
+}
+
+static void
+ecef (out_t * o, const char *t, int64_t v)
+{                               // um as metres attribute, no decimal places if whole
+   const char *s = "";
+   if (v < 0)
+   {
+      v = 0 - v;
+      s = "-";
+   }
+   if (v % 1000000LL)
+      add (o, " %s=\"%s%lld.%06lld\"", t, s, (long long) v / 1000000LL, (long long) v % 1000000LL);
+   else
+      add (o, " %s=\"%s%lld\"", t, s, (long long) v / 1000000LL);
+}
+
+int
+loggpx_fix (char *buf, int size, fix_t * f, uint32_t fields, int64_t odoadjust, uint8_t errors)
+{                               // Fix as trkpt
+   if (!f->setlla || size < 2)
+      return 0;
+   out_t o = {.p = buf,.e = buf + size - 1 };
+   add (&o, "<trkpt lat=\"%.8lf\" lon=\"%.8lf\">", f->lat, f->lon);
+   if (!isnan (f->alt))
+      add (&o, "<ele>%.2f</ele>", f->alt);
+   char ts[30];
+   if (f->sett && logjson_ts (ts, f->ecef.t))
+      add (&o, "<time>%s</time>", ts);
+   if ((fields & LOGBIN_UND) && f->slow.fixmode >= 3 && !isnan (f->und))
+      add (&o, "<geoidheight>%.2f</geoidheight>", f->und);
+   if (f->slow.fixmode >= 1)
+      add (&o, "<fix>%s</fix>", f->slow.fixmode == 1 ? "none" : f->slow.fixmode == 2 ? "2d" : "3d");
+   if (f->sats)
+      add (&o, "<sat>%d</sat>", f->sats);
+   if (!isnan (f->hdop) && f->hdop)
+      add (&o, "<hdop>%.1f</hdop>", f->hdop);
+   if (!isnan (f->slow.vdop) && f->slow.vdop)
+      add (&o, "<vdop>%.1f</vdop>", f->slow.vdop);
+   if (!isnan (f->slow.pdop) && f->slow.pdop)
+      add (&o, "<pdop>%.1f</pdop>", f->slow.pdop);
+   char *x = o.p;
+   add (&o, "<extensions>");
+   char *y = o.p;
+   if (fields & LOGBIN_SEQ)
+      add (&o, "<gpslog:seq>%lu</gpslog:seq>", (unsigned long) f->seq);
+   if ((fields & LOGBIN_SATS) && f->slow.gsa[0] + f->slow.gsa[1] + f->slow.gsa[2])
+   {
+      add (&o, "<gpslog:sats");
+      for (int s = 0; s < SYSTEMS; s++)
+         if (f->slow.gsa[s])
+            add (&o, " %s=\"%d\"", system_name[s], f->slow.gsa[s]);
+      add (&o, "/>");
+   }
+   if ((fields & LOGBIN_LLA) && f->quality)
+      add (&o, "<gpslog:quality>%d</gpslog:quality>", f->quality);
+   if ((fields & LOGBIN_EPE) && f->setepe && f->slow.fixmode >= 1)
+   {
+      if (f->hepe > 0)
+         add (&o, "<gpslog:hepe>%.2f</gpslog:hepe>", f->hepe);
+      if (f->vepe > 0 && f->slow.fixmode >= 3)
+         add (&o, "<gpslog:vepe>%.2f</gpslog:vepe>", f->vepe);
+   }
+   uint8_t speed = (f->quality && !isnan (f->slow.speed) && f->slow.speed != 0);
+   if ((fields & LOGBIN_CS) && speed)
+   {
+      add (&o, "<gpslog:speed>%.2f</gpslog:speed>", f->slow.speed);
+      if (!isnan (f->slow.course))
+         add (&o, "<gpslog:course>%.2f</gpslog:course>", f->slow.course);
+   }
+   if ((fields & LOGBIN_MPH) && speed)
+      add (&o, "<gpslog:mph>%.2f</gpslog:mph>", f->slow.speed / 1.609344);
+   if ((fields & LOGBIN_ECEF) && f->setecef)
+   {
+      add (&o, "<gpslog:ecef");
+      ecef (&o, "x", f->ecef.x);
+      ecef (&o, "y", f->ecef.y);
+      ecef (&o, "z", f->ecef.z);
+      if (f->sett)
+         ecef (&o, "t", f->ecef.t);
+      add (&o, "/>");
+   }
+   if ((fields & LOGBIN_ACC) && f->setacc)
+      add (&o, "<gpslog:acc x=\"%.3f\" y=\"%.3f\" z=\"%.3f\"%s%s/>", f->acc.x, f->acc.y, f->acc.z, f->accmove ? " move=\"true\"" : "",
+           f->acccrash ? " crash=\"true\"" : "");
+   if ((fields & LOGBIN_DSQ) && !isnan (f->dsq))
+      add (&o, "<gpslog:dsq>%f</gpslog:dsq>", f->dsq);
+   if ((fields & LOGBIN_ODO) && f->setodo && f->odo >= ODOBASE)
+   {
+      uint64_t odo = f->odo + odoadjust;
+      add (&o, "<gpslog:odo>%llu.%02llu</gpslog:odo>", (unsigned long long) odo / 100LL, (unsigned long long) odo % 100LL);
+   }
+   if (errors)
+      add (&o, "<gpslog:errors>%d</gpslog:errors>", errors);
+   if (f->home && f->setecef)
+      add (&o, "<gpslog:home/>");
+   if (f->waypoint)
+      add (&o, "<gpslog:waypoint/>");
+   if (o.p == y)
+      o.p = x;                  // No extensions
+   else
+      add (&o, "</extensions>");
+   add (&o, "</trkpt>\r\n");
+   *o.p = 0;
+   return o.p - buf;
+}
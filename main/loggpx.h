@@ -0,0 +1,21 @@
+// GPS logger GPX log track points, written straight in to a buffer, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+
+// Standard GPX 1.1 elements, then an extensions block with the other logged fields, named as in the JSON log
+
+#ifndef	LOGGPX_H
+#define	LOGGPX_H
+
+#include "logjson.h"            // Fix, fields to log, system names
+
+#define	LOGGPX_MAX	1000    // Max trkpt length, including null
+
+#define	LOGGPX_HEAD	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n"       \
+			"<gpx version=\"1.1\" creator=\"GPS logger\" xmlns=\"http://www.topografix.com/GPX/1/1\" xmlns:gpslog=\"https://github.com/revk/ESP32-GPS\">\r\n"
+#define	LOGGPX_TRK	"<trk><trkseg>\r\n"
+#define	LOGGPX_TRKEND	"</trkseg></trk>\r\n"
+#define	LOGGPX_END	"</gpx>\r\n"
+
+int loggpx_fix (char *buf, int size, fix_t * f, uint32_t fields, int64_t odoadjust, uint8_t errors);    // Fix as trkpt in buf, return length, 0 if no position
+
+#endif
@@ -0,0 +1,417 @@
+// GPS logger JSON log line, written straight in to a buffer, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+// This makes exactly what log_line did using jo_t, but with no heap use, integers and fixed point done directly
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "logjson.h"
+
+const char *const system_name[SYSTEMS] = { "NAVSTAR", "GLONASS", "GALILEO" };
+
+typedef struct out_s out_t;
+struct out_s
+{
+   char *p;                     // Next
+   char *e;                     // End (space for null)
+   char c;                      // Next separator
+};
+
+static void
+add (out_t * o, const char *s)
+{
+   while (*s && o->p < o->e)
+      *o->p++ = *s++;
+}
+
+static void
+addc (out_t * o, char c)
+{
+   if (o->p < o->e)
+      *o->p++ = c;
+}
+
+static void
+addu (out_t * o, uint64_t v, int places)
+{                               // Decimal, at least places digits
+   char t[21],
+    *p = t + sizeof (t);
+   while (v || places > 0 || p == t + sizeof (t))
+   {
+      *--p = '0' + v % 10;
+      v /= 10;
+      places--;
+   }
+   while (p < t + sizeof (t) && o->p < o->e)
+      *o->p++ = *p++;
+}
+
+static void
+addf (out_t * o, const char *fmt, ...)
+{                               // Floating point, via snprintf
+   va_list ap;
+   va_start (ap, fmt);
+   int l = vsnprintf (o->p, o->e - o->p + 1, fmt, ap);
+   va_end (ap);
+   if (l > 0)
+      o->p += (l < o->e - o->p ? l : o->e - o->p);
+}
+
+static void
+tag (out_t * o, const char *t)
+{                               // Separator and tag
+   addc (o, o->c);
+   o->c = ',';
+   addc (o, '"');
+   add (o, t);
+   add (o, "\":");
+}
+
+static void
+ecef (out_t * o, const char *t, int64_t v)
+{                               // um as metres, no decimal places if whole
+   tag (o, t);
+   if (v < 0)
+   {
+      v = 0 - v;
+      addc (o, '-');
+   }
+   addu (o, v / 1000000LL, 0);
+   if (v % 1000000LL)
+   {
+      addc (o, '.');
+      addu (o, v % 1000000LL, 6);
+   }
+}
+
+static void
+two (char *p, int v)
+{
+   p[0] = '0' + v / 10;
+   p[1] = '0' + v % 10;
+}
+
+int
+logjson_ts (char *buf, uint64_t when)
+{                               // ISO timestamp, cached per task, only fields that changed since last call are remade
+   static __thread struct
+   {
+      int64_t sec;              // Second cached, -1 for none
+      uint8_t valid;            // Valid year
+      char ts[20];              // YYYY-MM-DDTHH:MM:SS
+   } c = {.sec = -1 };
+   int64_t sec = when / 1000000LL;
+   if (sec != c.sec)
+   {
+      if (c.sec < 0 || sec / 86400 != c.sec / 86400)
+      {                         // New day
+         struct tm t;
+         time_t now = sec;
+         gmtime_r (&now, &t);
+         c.valid = (t.tm_year >= 100);
+         out_t o = {.p = c.ts,.e = c.ts + 10 };
+         addu (&o, t.tm_year + 1900, 4);
+         addc (&o, '-');
+         addu (&o, t.tm_mon + 1, 2);
+         addc (&o, '-');
+         addu (&o, t.tm_mday, 2);
+         c.ts[10] = 'T';
+         c.ts[13] = c.ts[16] = ':';
+         c.sec = -1;
+      }
+      int s = sec % 86400;
+      if (c.sec < 0 || sec / 60 != c.sec / 60)
+      {                         // New minute
+         two (c.ts + 11, s / 3600);
+         two (c.ts + 14, s / 60 % 60);
+      }
+      two (c.ts + 17, s % 60);
+      c.sec = sec;
+   }
+   if (!c.valid)
+   {
+      *buf = 0;
+      return 0;
+   }
+   memcpy (buf, c.ts, 19);
+   char *p = buf + 19;
+   uint32_t ms = when / 1000LL % 1000LL;
+   if (ms)
+   {
+      *p++ = '.';
+      *p++ = '0' + ms / 100;
+      two (p, ms % 100);
+      p += 2;
+   }
+   *p++ = 'Z';
+   *p = 0;
+   return p - buf;
+}
+
+enum
+{                               // Plan steps, in output order
+   STEP_TS,
+   STEP_SEQ,
+   STEP_SATS,
+   STEP_FIXMODE,
+   STEP_LLA,
+   STEP_UND,
+   STEP_EPE,
+   STEP_DOP,
+   STEP_CS,
+   STEP_MPH,
+   STEP_ECEF,
+   STEP_ACC,
+   STEP_DSQ,
+   STEP_ODO,
+   STEP_ERRORS,
+   STEP_HOME,
+   STEP_WAYPOINT,
+};
+
+void
+logjson_plan (logjson_plan_t * p, uint32_t fields)
+{                               // Steps for fields, so per fix is just the steps, no settings checked
+   static const struct
+   {
+      uint8_t step;
+      uint32_t field;           // 0 for always
+   } all[] = {
+      {STEP_TS, 0},
+      {STEP_SEQ, LOGBIN_SEQ},
+      {STEP_SATS, LOGBIN_SATS},
+      {STEP_FIXMODE, 0},
+      {STEP_LLA, LOGBIN_LLA},
+      {STEP_UND, LOGBIN_UND},
+      {STEP_EPE, LOGBIN_EPE},
+      {STEP_DOP, LOGBIN_DOP},
+      {STEP_CS, LOGBIN_CS},
+      {STEP_MPH, LOGBIN_MPH},
+      {STEP_ECEF, LOGBIN_ECEF},
+      {STEP_ACC, LOGBIN_ACC},
+      {STEP_DSQ, LOGBIN_DSQ},
+      {STEP_ODO, LOGBIN_ODO},
+      {STEP_ERRORS, 0},
+      {STEP_HOME, 0},
+      {STEP_WAYPOINT, 0},
+   };
+   p->fields = fields;
+   p->steps = 0;
+   for (size_t i = 0; i < sizeof (all) / sizeof (*all); i++)
+      if (!all[i].field || (fields & all[i].field))
+         p->step[p->steps++] = all[i].step;
+}
+
+int
+logjson_fix_plan (char *buf, int size, fix_t * f, const logjson_plan_t * p, int64_t odoadjust, uint8_t errors)
+{                               // Fix as JSON object, as log_line, following plan
+   if (size < 3)
+      return 0;
+   out_t o = {.p = buf,.e = buf + size - 1,.c = '{' };
+   for (const uint8_t * s = p->step, *e = p->step + p->steps; s < e; s++)
+      switch (*s)
+      {
+      case STEP_TS:
+         if (f->sett)
+         {
+            char ts[30];
+            if (logjson_ts (ts, f->ecef.t))
+            {
+               tag (&o, "ts");
+               addc (&o, '"');
+               add (&o, ts);
+               addc (&o, '"');
+            }
+         }
+         break;
+      case STEP_SEQ:
+         tag (&o, "seq");
+         addu (&o, f->seq, 0);
+         break;
+      case STEP_SATS:
+         if (f->sats + f->slow.gsa[0] + f->slow.gsa[1] + f->slow.gsa[2])
+         {
+            tag (&o, "sats");
+            char c = o.c;
+            o.c = '{';
+            for (int s = 0; s < SYSTEMS; s++)
+               if (f->slow.gsa[s])
+               {
+                  tag (&o, system_name[s]);
+                  addu (&o, f->slow.gsa[s], 0);
+               }
+            if (f->sats)
+            {
+               tag (&o, "used");
+               addu (&o, f->sats, 0);
+            }
+            if (o.c == '{')
+               addc (&o, '{');
+            addc (&o, '}');
+            o.c = c;
+         }
+         break;
+      case STEP_FIXMODE:
+         if (f->slow.fixmode)
+         {
+            tag (&o, "fixmode");
+            addu (&o, f->slow.fixmode, 0);
+         }
+         break;
+      case STEP_LLA:
+         if (f->setlla && f->quality)
+         {
+            tag (&o, "lat");
+            addf (&o, "%.8lf", f->lat);
+            tag (&o, "lon");
+            addf (&o, "%.8lf", f->lon);
+            if (f->slow.fixmode >= 3 && !isnan (f->alt))
+            {
+               tag (&o, "alt");
+               addf (&o, "%.2f", f->alt);
+            }
+            tag (&o, "quality");
+            addu (&o, f->quality, 0);
+         }
+         break;
+      case STEP_UND:
+         if (f->slow.fixmode >= 3 && !isnan (f->und))
+         {
+            tag (&o, "und");
+            addf (&o, "%.2f", f->und);
+         }
+         break;
+      case STEP_EPE:
+         if (f->setepe && f->slow.fixmode >= 1)
+         {
+            if (f->hepe > 0)
+            {
+               tag (&o, "hepe");
+               addf (&o, "%.2f", f->hepe);
+            }
+            if (f->vepe > 0 && f->slow.fixmode >= 3)
+            {
+               tag (&o, "vepe");
+               addf (&o, "%.2f", f->vepe);
+            }
+         }
+         break;
+      case STEP_DOP:
+         if (!isnan (f->hdop) && f->hdop)
+         {
+            tag (&o, "hdop");
+            addf (&o, "%.1f", f->hdop);
+         }
+         if (!isnan (f->slow.pdop) && f->slow.pdop)
+         {
+            tag (&o, "pdop");
+            addf (&o, "%.1f", f->slow.pdop);
+         }
+         if (!isnan (f->slow.vdop) && f->slow.vdop && f->slow.fixmode >= 3)
+         {
+            tag (&o, "vdop");
+            addf (&o, "%.1f", f->slow.vdop);
+         }
+         break;
+      case STEP_CS:
+         if (f->quality && !isnan (f->slow.speed) && f->slow.speed != 0)
+         {
+            tag (&o, "speed");
+            addf (&o, "%.2f", f->slow.speed);
+            if (!isnan (f->slow.course))
+            {
+               tag (&o, "course");
+               addf (&o, "%.2f", f->slow.course);
+            }
+         }
+         break;
+      case STEP_MPH:
+         if (f->quality && !isnan (f->slow.speed) && f->slow.speed != 0)
+         {
+            tag (&o, "mph");
+            addf (&o, "%.2f", f->slow.speed / 1.609344);
+         }
+         break;
+      case STEP_ECEF:
+         if (f->setecef)
+         {
+            tag (&o, "ecef");
+            char c = o.c;
+            o.c = '{';
+            ecef (&o, "x", f->ecef.x);
+            ecef (&o, "y", f->ecef.y);
+            ecef (&o, "z", f->ecef.z);
+            if (f->sett)
+               ecef (&o, "t", f->ecef.t);
+            addc (&o, '}');
+            o.c = c;
+         }
+         break;
+      case STEP_ACC:
+         if (f->setacc)
+         {
+            tag (&o, "acc");
+            addf (&o, "{\"x\":%.3f,\"y\":%.3f,\"z\":%.3f", f->acc.x, f->acc.y, f->acc.z);
+            if (f->accmove)
+               add (&o, ",\"move\":true");
+            if (f->acccrash)
+               add (&o, ",\"crash\":true");
+            addc (&o, '}');
+         }
+         break;
+      case STEP_DSQ:
+         if (!isnan (f->dsq))
+         {
+            tag (&o, "dsq");
+            addf (&o, "%f", f->dsq);
+         }
+         break;
+      case STEP_ODO:
+         if (f->setodo && f->odo >= ODOBASE)
+         {
+            uint64_t odo = f->odo + odoadjust;
+            tag (&o, "odo");
+            addu (&o, odo / 100LL, 0);
+            addc (&o, '.');
+            addu (&o, odo % 100LL, 2);
+         }
+         break;
+      case STEP_ERRORS:
+         if (errors)
+         {
+            tag (&o, "errors");
+            addu (&o, errors, 0);
+         }
+         break;
+      case STEP_HOME:
+         if (f->home && f->setecef)
+         {
+            tag (&o, "home");
+            add (&o, "true");
+         }
+         break;
+      case STEP_WAYPOINT:
+         if (f->waypoint)
+         {
+            tag (&o, "waypoint");
+            add (&o, "true");
+         }
+         break;
+      }
+   if (o.c == '{')
+      addc (&o, '{');
+   addc (&o, '}');
+   *o.p = 0;
+   return o.p - buf;
+}
+
+int
+logjson_fix (char *buf, int size, fix_t * f, uint32_t fields, int64_t odoadjust, uint8_t errors)
+{                               // Fix as JSON object, plan cached per task and only remade if fields change
+   static __thread logjson_plan_t plan = { 0 };
+   if (!plan.steps || plan.fields != fields)
+      logjson_plan (&plan, fields);
+   return logjson_fix_plan (buf, size, f, &plan, odoadjust, errors);
+}
@@ -0,0 +1,28 @@
+// GPS logger JSON log line, written straight in to a buffer, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+
+#ifndef	LOGJSON_H
+#define	LOGJSON_H
+
+#include "logbin.h"             // Fix, and fields to log
+
+#define	LOGJSON_MAX	1000    // Max fix line length, including null
+
+#define	LOGJSON_STEPS	20      // Max steps in a plan
+
+extern const char *const system_name[SYSTEMS];
+
+typedef struct logjson_plan_s logjson_plan_t;
+struct logjson_plan_s
+{                               // Steps to make a fix line for a set of fields
+   uint32_t fields;             // Fields this is for
+   uint8_t steps;               // Number of steps
+   uint8_t step[LOGJSON_STEPS];
+};
+
+int logjson_ts (char *buf, uint64_t when);      // ISO timestamp in buf (at least 30 bytes), cached per task, return length, 0 (and buf empty) if not valid time
+void logjson_plan (logjson_plan_t * p, uint32_t fields);        // Make plan for fields, done once when log settings change
+int logjson_fix_plan (char *buf, int size, fix_t * f, const logjson_plan_t * p, int64_t odoadjust, uint8_t errors);     // Fix as JSON object in buf, following plan, return length
+int logjson_fix (char *buf, int size, fix_t * f, uint32_t fields, int64_t odoadjust, uint8_t errors);   // As logjson_fix_plan, with plan cached per task, remade if fields change
+
+#endif
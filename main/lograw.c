@@ -0,0 +1,359 @@
+// GPS logger live journey written in place in a preallocated region, so no FAT updates whilst logging, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+// The region is a file made once at full size, then written by offset in whole sectors, each with a trailer at the end
+// Sectors are collected and written a block at a time. A checkpoint writes the sectors so far, the last one partly filled,
+// and carries on in the next sector, so no sector is written twice, and power lost whilst writing can only lose what was
+// after the last checkpoint. Reading stops at the first sector that is not the next in sequence for the journey, or fails
+// CRC, so sectors left from an earlier journey, or part written, are ignored. Sector 0 is written (empty, for the new journey)
+// as the journey starts, so a journey's first sector is never one left from before, or whatever was in a new region's clusters.
+// When the journey closes it is made in to a normal log file, and the region marked done.
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "lograw.h"
+#include "logz.h"
+#ifdef	ESP_PLATFORM
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_heap_caps.h"
+#define	lograw_alloc(n)	heap_caps_aligned_alloc(4,n,MALLOC_CAP_DMA)
+#define	lograw_free(p)	heap_caps_free(p)
+#else
+#include <time.h>
+#define	lograw_alloc(n)	malloc(n)
+#define	lograw_free(p)	free(p)
+int (*lograw_card) (int fd, off_t pos, const uint8_t * buf, size_t len) = NULL;
+#endif
+
+sdlog_stats_t lograw_stats = { 0 };
+
+typedef struct lograw_s lograw_t;
+struct lograw_s
+{
+   int fd;                      // Region
+   uint8_t *buf;                // Block of sectors
+   uint32_t block;              // Block size
+   uint32_t sectors;            // Sectors in region
+   uint32_t journey;            // Journey ID
+   uint32_t seq;                // Next sector (being filled)
+   uint32_t base;               // Sector at start of buf
+   uint32_t done;               // Writing, sectors at start of buf written to card, reading, sectors in buf
+   uint32_t len;                // Data in current sector
+   uint32_t pos;                // Reading, position in current sector
+   uint8_t end:1;               // Reading, no more valid sectors
+};
+
+static FILE *lograw_file = NULL;        // Current journey, if writing
+static lograw_t *lograw_current = NULL;
+
+static int64_t
+lograw_now (void)
+{                               // us
+#ifdef	ESP_PLATFORM
+   return esp_timer_get_time ();
+#else
+   struct timespec t;
+   clock_gettime (CLOCK_MONOTONIC, &t);
+   return (int64_t) t.tv_sec * 1000000LL + t.tv_nsec / 1000;
+#endif
+}
+
+static uint32_t
+lograw_crc (const uint8_t * data, lograw_trailer_t * t)
+{                               // CRC of data and trailer (before crc)
+   return logz_crc (logz_crc (0, data, t->len), (const uint8_t *) t, sizeof (*t) - sizeof (t->crc));
+}
+
+static int
+lograw_flush (lograw_t * w)
+{                               // Write sectors completed in buf and not yet written
+   uint32_t n = w->seq - w->base;
+   if (n == w->done)
+      return 0;
+   off_t pos = (off_t) (w->base + w->done) * LOGRAW_SECTOR;
+   uint8_t *buf = w->buf + w->done * LOGRAW_SECTOR;
+   size_t len = (n - w->done) * LOGRAW_SECTOR;
+   int64_t start = lograw_now ();
+   int e;
+#ifndef	ESP_PLATFORM
+   if (lograw_card)
+      e = lograw_card (w->fd, pos, buf, len);
+   else
+#endif
+      e = (lseek (w->fd, pos, SEEK_SET) != pos || write (w->fd, buf, len) != (ssize_t) len) ? -1 : 0;
+   uint32_t us = lograw_now () - start;
+   lograw_stats.us += us;
+   if (us > lograw_stats.maxus)
+      lograw_stats.maxus = us;
+   lograw_stats.writes++;
+   int b = 0;
+   while (b < SDLOG_HIST - 1 && us >= (1000UL << b))
+      b++;
+   lograw_stats.hist[b]++;
+   if (e)
+   {
+      lograw_stats.errors++;
+      errno = EIO;
+      return -1;
+   }
+   lograw_stats.written += len;
+   if (n * LOGRAW_SECTOR == w->block)
+   {                            // Start new block
+      w->base = w->seq;
+      w->done = 0;
+   } else
+      w->done = n;
+   return 0;
+}
+
+static int
+lograw_seal (lograw_t * w, uint32_t flags)
+{                               // Finish current sector, writing block if full
+   uint8_t *s = w->buf + (w->seq - w->base) * LOGRAW_SECTOR;
+   lograw_trailer_t t = {.magic = LOGRAW_MAGIC,.journey = w->journey,.seq = w->seq,.len = w->len,.flags = flags };
+   t.crc = lograw_crc (s, &t);
+   memset (s + w->len, 0, LOGRAW_DATA - w->len);
+   memcpy (s + LOGRAW_DATA, &t, sizeof (t));
+   w->seq++;
+   w->len = 0;
+   if ((w->seq - w->base) * LOGRAW_SECTOR == w->block)
+      return lograw_flush (w);
+   return 0;
+}
+
+static ssize_t
+lograw_write (void *cookie, const char *buf, size_t size)
+{
+   lograw_t *w = cookie;
+   size_t done = 0;
+   while (done < size)
+   {
+      if (w->seq >= w->sectors)
+      {
+         errno = ENOSPC;
+         return -1;
+      }
+      if ((w->seq - w->base) * LOGRAW_SECTOR >= w->block && lograw_flush (w))
+         return -1;             // Block not written
+      size_t l = LOGRAW_DATA - w->len;
+      if (l > size - done)
+         l = size - done;
+      memcpy (w->buf + (w->seq - w->base) * LOGRAW_SECTOR + w->len, buf + done, l);
+      w->len += l;
+      done += l;
+      if (w->len == LOGRAW_DATA && lograw_seal (w, 0))
+         return -1;
+   }
+   lograw_stats.bytes += size;
+   return size;
+}
+
+static int
+lograw_next (lograw_t * r)
+{                               // Next sector, if valid
+   if (r->end)
+      return -1;
+   if (r->seq - r->base >= r->done)
+   {                            // Read block
+      r->base = r->seq;
+      r->done = 0;
+      if (r->seq >= r->sectors)
+      {
+         r->end = 1;
+         return -1;
+      }
+      off_t pos = (off_t) r->seq * LOGRAW_SECTOR;
+      ssize_t l = r->block;
+      if (l > (ssize_t) (r->sectors - r->seq) * LOGRAW_SECTOR)
+         l = (r->sectors - r->seq) * LOGRAW_SECTOR;
+      if (lseek (r->fd, pos, SEEK_SET) == pos && (l = read (r->fd, r->buf, l)) > 0)
+         r->done = l / LOGRAW_SECTOR;
+   }
+   lograw_trailer_t t = { 0 };
+   uint8_t *s = r->buf + (r->seq - r->base) * LOGRAW_SECTOR;
+   if (r->done)
+      memcpy (&t, s + LOGRAW_DATA, sizeof (t));
+   if (t.magic != LOGRAW_MAGIC || !t.journey || (r->seq && t.journey != r->journey) || t.seq != r->seq || t.len > LOGRAW_DATA
+       || t.crc != lograw_crc (s, &t))
+   {
+      r->end = 1;
+      return -1;
+   }
+   r->journey = t.journey;
+   r->seq++;
+   r->len = t.len;
+   r->pos = 0;
+   return 0;
+}
+
+static ssize_t
+lograw_read (void *cookie, char *buf, size_t size)
+{
+   lograw_t *r = cookie;
+   size_t done = 0;
+   while (done < size && (r->pos < r->len || !lograw_next (r)))
+   {
+      size_t l = r->len - r->pos;
+      if (l > size - done)
+         l = size - done;
+      memcpy (buf + done, r->buf + (r->seq - 1 - r->base) * LOGRAW_SECTOR + r->pos, l);
+      r->pos += l;
+      done += l;
+   }
+   return done;
+}
+
+static void
+lograw_release (lograw_t * s)
+{
+   lograw_free (s->buf);
+   free (s);
+}
+
+static int
+lograw_close (void *cookie)
+{
+   lograw_t *s = cookie;
+   int e = 0;
+   if (s == lograw_current)
+   {                            // Writing
+      lograw_current = NULL;
+      lograw_file = NULL;
+      if ((s->len && lograw_seal (s, 0)) || lograw_flush (s))
+         e = -1;
+   }
+   if (close (s->fd))
+      e = -1;
+   lograw_release (s);
+   return e;
+}
+
+static lograw_t *
+lograw_new (const char *region, uint32_t block, int flags)
+{
+   if (block < LOGRAW_SECTOR || (block % LOGRAW_SECTOR))
+      return NULL;
+   lograw_t *s = malloc (sizeof (*s));
+   if (!s)
+      return NULL;
+   memset (s, 0, sizeof (*s));
+   s->block = block;
+   s->buf = lograw_alloc (block);
+   s->fd = open (region, flags, 0666);
+   if (!s->buf || s->fd < 0)
+   {
+      if (s->fd >= 0)
+         close (s->fd);
+      lograw_release (s);
+      return NULL;
+   }
+   return s;
+}
+
+FILE *
+lograw_open (const char *region, uint32_t size, uint32_t block)
+{
+   memset (&lograw_stats, 0, sizeof (lograw_stats));
+   lograw_t *w = lograw_new (region, block, O_RDWR | O_CREAT);
+   if (!w)
+      return NULL;
+   struct stat s;
+   w->sectors = size / LOGRAW_SECTOR;
+   off_t end = (off_t) w->sectors * LOGRAW_SECTOR;
+   if (w->sectors < 2 || fstat (w->fd, &s)
+       || (s.st_size < end && (lseek (w->fd, end - 1, SEEK_SET) != end - 1 || write (w->fd, "", 1) != 1)))
+   {                            // Cannot make region, this is the only time FAT is updated, clusters allocated
+      close (w->fd);
+      lograw_release (w);
+      return NULL;
+   }
+#ifdef	ESP_PLATFORM
+   while (!(w->journey = esp_random ()));
+#else
+   while (!(w->journey = random ()));
+#endif
+   if (lograw_seal (w, LOGRAW_SYNC) || lograw_flush (w))
+   {                            // Sector 0 for this journey, at once, so later sectors only count if their journey matches it
+      close (w->fd);
+      lograw_release (w);
+      return NULL;
+   }
+   cookie_io_functions_t io = {.write = lograw_write,.close = lograw_close };
+   FILE *o = fopencookie (w, "w", io);
+   if (!o)
+   {
+      close (w->fd);
+      lograw_release (w);
+      return NULL;
+   }
+   lograw_file = o;
+   lograw_current = w;
+   return o;
+}
+
+int
+lograw_sync (FILE * o)
+{                               // Checkpoint, whole sectors go straight to the card, so no fsync, which would only update the directory entry
+   if (o != lograw_file)
+      return -1;
+   int64_t start = lograw_now ();
+   int e = fflush (o);
+   if ((lograw_current->len && lograw_seal (lograw_current, LOGRAW_SYNC)) || lograw_flush (lograw_current))
+      e = -1;
+   uint32_t us = lograw_now () - start;
+   lograw_stats.syncs++;
+   lograw_stats.syncus += us;
+   if (us > lograw_stats.maxsyncus)
+      lograw_stats.maxsyncus = us;
+   return e;
+}
+
+uint32_t
+lograw_left (FILE * o)
+{
+   if (o != lograw_file)
+      return 0;
+   return lograw_current->sectors - lograw_current->seq;
+}
+
+FILE *
+lograw_reader (const char *region, uint32_t block)
+{
+   lograw_t *r = lograw_new (region, block, O_RDONLY);
+   if (!r)
+      return NULL;
+   struct stat s;
+   if (!fstat (r->fd, &s))
+      r->sectors = s.st_size / LOGRAW_SECTOR;
+   cookie_io_functions_t io = {.read = lograw_read,.close = lograw_close };
+   FILE *i = fopencookie (r, "r", io);
+   if (!i)
+   {
+      close (r->fd);
+      lograw_release (r);
+      return NULL;
+   }
+   if (lograw_next (r))
+   {                            // Not even first sector
+      fclose (i);
+      return NULL;
+   }
+   return i;
+}
+
+int
+lograw_done (const char *region)
+{                               // Clear first sector trailer
+   int fd = open (region, O_WRONLY);
+   if (fd < 0)
+      return -1;
+   lograw_trailer_t t = { 0 };
+   int e = (lseek (fd, LOGRAW_DATA, SEEK_SET) != LOGRAW_DATA || write (fd, &t, sizeof (t)) != sizeof (t)) ? -1 : 0;
+   if (close (fd))
+      e = -1;
+   return e;
+}
@@ -0,0 +1,41 @@
+// GPS logger live journey written in place in a preallocated region, so no FAT updates whilst logging, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+
+#ifndef	LOGRAW_H
+#define	LOGRAW_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "sdlog.h"
+
+#define	LOGRAW_SECTOR	512     // Each sector has data and a trailer
+#define	LOGRAW_BLOCK	4096    // Default write size, whole sectors
+#define	LOGRAW_MAGIC	0x5741524CUL    // "LRAW"
+
+typedef struct lograw_trailer_s lograw_trailer_t;
+struct lograw_trailer_s
+{                               // At end of each sector
+   uint32_t magic;              // LOGRAW_MAGIC
+   uint32_t journey;            // Random per journey, so sectors left from an earlier journey are not valid
+   uint32_t seq;                // Sector number in journey, from 0
+   uint32_t len;                // Data in sector
+   uint32_t flags;              // LOGRAW_SYNC
+   uint32_t crc;                // CRC32 of data and the above
+};
+#define	LOGRAW_SYNC	1       // Sector written at checkpoint, not full
+#define	LOGRAW_DATA	(LOGRAW_SECTOR-sizeof(lograw_trailer_t))        // Data per sector
+
+extern sdlog_stats_t lograw_stats;      // Stats for current (or last) journey, bytes is data, written includes trailers and unused space in checkpoint sectors
+
+FILE *lograw_open (const char *region, uint32_t size, uint32_t block);  // New journey, region preallocated to size bytes if not already, written in block sized writes
+int lograw_sync (FILE * o);     // Checkpoint, all data so far is on the card, in sectors that are not written again
+uint32_t lograw_left (FILE * o);        // Sectors left in region
+FILE *lograw_reader (const char *region, uint32_t block);       // Read journey in region, to last valid sector, NULL if none
+int lograw_done (const char *region);   // Mark journey as no longer needed, i.e. now in a log file
+
+#ifndef	ESP_PLATFORM
+extern int (*lograw_card) (int fd, off_t pos, const uint8_t * buf, size_t len); // Host only, replaces card writes, for simulating power loss
+#endif
+
+#endif
@@ -0,0 +1,154 @@
+// GPS logger streaming gzip compression of log files, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+// On device this uses the miniz deflate in ROM, with its (large) state in PSRAM, on host it uses zlib with the same settings
+
+#include <stdlib.h>
+#include <string.h>
+#include "logz.h"
+#ifdef	ESP_PLATFORM
+#include "esp_heap_caps.h"
+#include "rom/miniz.h"
+#else
+#include <zlib.h>
+#endif
+
+#define	LOGZ_BUF	1024    // Output buffer
+
+struct logz_s
+{
+   logz_out_t *out;             // Output
+   void *arg;
+   uint32_t crc;                // CRC of uncompressed data
+   uint32_t size;               // Size of uncompressed data
+#ifdef	ESP_PLATFORM
+   tdefl_compressor *d;
+#else
+   z_stream d;
+#endif
+   uint8_t buf[LOGZ_BUF];
+};
+
+uint32_t
+logz_crc (uint32_t crc, const uint8_t * p, size_t len)
+{                               // CRC32 as gzip, 4 bits at a time
+   static const uint32_t t[16] = {
+      0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+      0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+   };
+   crc = ~crc;
+   while (len--)
+   {
+      crc ^= *p++;
+      crc = (crc >> 4) ^ t[crc & 15];
+      crc = (crc >> 4) ^ t[crc & 15];
+   }
+   return ~crc;
+}
+
+static int
+logz_deflate (logz_t * z, const uint8_t * p, size_t len, int finish)
+{                               // Compress, and output what is made
+#ifdef	ESP_PLATFORM
+   while (1)
+   {
+      size_t inlen = len,
+         outlen = sizeof (z->buf);
+      tdefl_status s = tdefl_compress (z->d, p, &inlen, z->buf, &outlen, finish ? TDEFL_FINISH : TDEFL_NO_FLUSH);
+      p += inlen;
+      len -= inlen;
+      if (s < 0 || (outlen && z->out (z->arg, z->buf, outlen)))
+         return -1;
+      if (s == TDEFL_STATUS_DONE || (!finish && !len && outlen < sizeof (z->buf)))
+         return 0;
+   }
+#else
+   z->d.next_in = (uint8_t *) p;
+   z->d.avail_in = len;
+   while (1)
+   {
+      z->d.next_out = z->buf;
+      z->d.avail_out = sizeof (z->buf);
+      int r = deflate (&z->d, finish ? Z_FINISH : Z_NO_FLUSH);
+      size_t outlen = sizeof (z->buf) - z->d.avail_out;
+      if (r == Z_STREAM_ERROR || (outlen && z->out (z->arg, z->buf, outlen)))
+         return -1;
+      if (r == Z_STREAM_END || (!finish && !z->d.avail_in && z->d.avail_out))
+         return 0;
+   }
+#endif
+}
+
+void
+logz_free (logz_t * z)
+{
+   if (!z)
+      return;
+#ifdef	ESP_PLATFORM
+   heap_caps_free (z->d);
+#else
+   deflateEnd (&z->d);
+#endif
+   free (z);
+}
+
+logz_t *
+logz_init (int level, logz_out_t * out, void *arg)
+{
+   if (level < 1)
+      level = 1;
+   if (level > 9)
+      level = 9;
+   logz_t *z = malloc (sizeof (*z));
+   if (!z)
+      return NULL;
+   memset (z, 0, sizeof (*z));
+   z->out = out;
+   z->arg = arg;
+#ifdef	ESP_PLATFORM
+   static const uint16_t probes[10] = { 0, 1, 6, 32, 16, 32, 128, 256, 512, 768 };      // As miniz levels
+   z->d = heap_caps_malloc (sizeof (tdefl_compressor), MALLOC_CAP_SPIRAM);
+   if (!z->d || tdefl_init (z->d, NULL, NULL, probes[level] | (level <= 3 ? TDEFL_GREEDY_PARSING_FLAG : 0)) != TDEFL_STATUS_OKAY)
+   {
+      heap_caps_free (z->d);
+      free (z);
+      return NULL;
+   }
+#else
+   if (deflateInit2 (&z->d, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+   {
+      free (z);
+      return NULL;
+   }
+#endif
+   static const uint8_t header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };        // gzip, deflate, no name or time, unknown OS
+   if (out (arg, header, sizeof (header)))
+   {
+      logz_free (z);
+      return NULL;
+   }
+   return z;
+}
+
+int
+logz_write (logz_t * z, const void *data, size_t len)
+{
+   z->crc = logz_crc (z->crc, data, len);
+   z->size += len;
+   return logz_deflate (z, data, len, 0);
+}
+
+int
+logz_finish (logz_t * z)
+{
+   int e = logz_deflate (z, NULL, 0, 1);
+   uint8_t trailer[8];
+   for (int i = 0; i < 4; i++)
+   {
+      trailer[i] = z->crc >> (i * 8);
+      trailer[4 + i] = z->size >> (i * 8);
+   }
+   if (!e)
+      e = z->out (z->arg, trailer, sizeof (trailer));
+   logz_free (z);
+   return e;
+}
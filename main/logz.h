@@ -0,0 +1,21 @@
+// GPS logger streaming gzip compression of log files, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+
+#ifndef	LOGZ_H
+#define	LOGZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define	LOGZ_EXT	".gz"   // Added to file name
+
+typedef struct logz_s logz_t;
+typedef int logz_out_t (void *arg, const uint8_t * data, size_t len);   // Output compressed data, return non zero on error
+
+logz_t *logz_init (int level, logz_out_t * out, void *arg);     // Start gzip stream, level 1-9, NULL if no memory
+int logz_write (logz_t * z, const void *data, size_t len);      // Compress data, return non zero on error
+int logz_finish (logz_t * z);   // Finish stream and free, return non zero on error
+void logz_free (logz_t * z);    // Free without finishing
+uint32_t logz_crc (uint32_t crc, const uint8_t * p, size_t len);       // CRC32 as gzip, start with 0
+
+#endif
@@ -0,0 +1,143 @@
+// GPS logger point reduction (packing), shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+// This is a modified Ramer-Douglas-Peucker, working on a queue of fixes as they arrive, see README
+
+#include <stdio.h>
+#include <math.h>
+#include "pack.h"
+
+float
+pack_dist2 (pack_t * p, fix_t * A, fix_t * B)
+{                               // Distance between two fixes
+   float X = ((float) (A->ecef.x - B->ecef.x)) / 1000000.0;
+   float Y = ((float) (A->ecef.y - B->ecef.y)) / 1000000.0;
+   float Z = ((float) (A->ecef.z - B->ecef.z)) / 1000000.0;
+   float T = 0;
+   if (p->time)
+      T = ((float) ((A->ecef.t - B->ecef.t) * p->dist / p->time)) / 1000000.0;
+   return X * X + Y * Y + Z * Z + T * T;
+}
+
+float
+pack_sed2 (fix_t * A, fix_t * B, fix_t * C)
+{                               // Square of synchronous Euclidean distance, done relative to A in double as ECEF is large
+   int64_t dt = B->ecef.t - A->ecef.t;
+   double s = (dt ? (double) (C->ecef.t - A->ecef.t) / dt : 0);
+   double X = ((double) (C->ecef.x - A->ecef.x) - (double) (B->ecef.x - A->ecef.x) * s) / 1000000.0;
+   double Y = ((double) (C->ecef.y - A->ecef.y) - (double) (B->ecef.y - A->ecef.y) * s) / 1000000.0;
+   double Z = ((double) (C->ecef.z - A->ecef.z) - (double) (B->ecef.z - A->ecef.z) * s) / 1000000.0;
+   return X * X + Y * Y + Z * Z;
+}
+
+float
+pack_linedist2 (pack_t * p, fix_t * A, fix_t * B, fix_t * C, float b2)
+{                               // Square of distance of C from line A to B, b2 is pack_dist2(B,A)
+   if (p->sed)
+      return pack_sed2 (A, B, C);
+   float a2 = pack_dist2 (p, A, C);
+   if (b2 == 0.0)
+      return a2;                // A/B same, so distance from A
+   float c2 = pack_dist2 (p, C, B);
+   if (c2 - b2 >= a2)
+      return a2;                // Off end of A
+   if (a2 - b2 >= c2)
+      return c2;                // Off end of B
+   return (4 * a2 * b2 - (a2 + b2 - c2) * (a2 + b2 - c2)) / (b2 * 4);   // see https://www.revk.uk/2024/01/distance-of-point-to-lie-in-four.html
+}
+
+fix_t *
+pack_findmax (pack_t * p, fix_t * A, fix_t * B, float *dsqp)
+{
+   if (dsqp)
+      *dsqp = 0;
+   if (!A || !B || A == B || A->next == B)
+      return NULL;
+   float b2 = pack_dist2 (p, B, A);
+   fix_t *m = NULL;
+   float best = 0;
+   for (fix_t * C = A->next; C && C != B; C = C->next)
+   {
+      float h2 = pack_linedist2 (p, A, B, C, b2);
+      C->dsq = h2;              // Before EPE adjust
+      if (m && h2 <= best)
+         continue;              // Not bigger
+      best = h2;
+      m = C;
+   }
+   if (dsqp)
+      *dsqp = best;
+   p->stats.scans++;
+   return m;
+}
+
+fix_t *
+pack_step (pack_t * p, fix_t * A, fix_t * B, uint8_t more)
+{                               // Pack A to B, marking corner and deleted fixes, return fix to output up to, or NULL if more can be waited for
+   float dsq = 0;
+   float cutoff = (float) p->dist * (float) p->dist;
+   if (p->P && more)
+   {                            // Only check new points - anything up to P is within bound of A-P, so within bound plus P's distance of A-B (also for SED)
+      float b2 = pack_dist2 (p, B, A);
+      float h2 = pack_linedist2 (p, A, B, p->P, b2);
+      float d = p->bound + (h2 > 0 ? sqrtf (h2) : 0);
+      for (fix_t * C = p->P->next; C && C != B && d * d < cutoff; C = C->next)
+      {
+         h2 = pack_linedist2 (p, A, B, C, b2);
+         if (h2 > d * d)
+            d = sqrtf (h2);
+      }
+      if (d * d < cutoff)
+      {                         // wait for more
+         p->bound = d;
+         p->P = B;
+         return NULL;
+      }
+   }
+   fix_t *M = pack_findmax (p, A, B, &dsq);
+   fix_t *E = M ? : B;
+   if (dsq < cutoff && more)
+   {                            // wait for more
+      p->bound = (dsq > 0 ? sqrtf (dsq) : 0);
+      p->P = B;
+      return NULL;
+   }
+   p->P = NULL;
+   A->corner = 1;
+   if (dsq < cutoff)
+   {
+      for (fix_t * X = A->next; X && X != B; X = X->next)
+         X->deleted = 1;        // All within cutoff
+      if (dsq > p->stats.dsq)
+         p->stats.dsq = dsq;
+   } else
+      while (A && M)
+      {                         // Check A to M - recursively
+         M->corner = 1;
+         B = M;
+         M = pack_findmax (p, A, B, &dsq);
+         if (dsq < cutoff)
+         {                      // Drop all in between as all within margin - otherwise process A to M again.
+            if (A != B)
+               for (fix_t * X = A->next; X && X != B; X = X->next)
+                  X->deleted = 1;
+            if (dsq > p->stats.dsq)
+               p->stats.dsq = dsq;
+            // Find next half
+            A = B;
+            M = A->next;
+            while (M && !M->corner)
+               M = M->next;
+         }
+      }
+   return E;
+}
+
+void
+pack_done (pack_t * p, fix_t * X)
+{                               // Stats for fix output from packing
+   p->stats.fixes++;
+   if (X->deleted && !X->waypoint)
+      p->stats.deleted++;
+   else if (X->corner)
+      p->stats.corners++;
+}
@@ -0,0 +1,31 @@
+// GPS logger point reduction (packing), shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+
+#include "fix.h"
+
+typedef struct pack_s pack_t;
+struct pack_s
+{                               // Packing settings and state
+   uint16_t dist;               // Pack distance margin (metres)
+   uint16_t time;               // Pack time margin (seconds)
+   uint8_t sed:1;               // Use synchronous Euclidean distance, i.e. from where expected at that time on line
+   fix_t *P;                    // Last end checked when all within cutoff
+   float bound;                 // Upper bound of deviation (not squared) of A to P from line A to P
+   struct
+   {                            // Stats
+      uint32_t fixes;           // Fixes packed
+      uint32_t corners;         // Corners kept
+      uint32_t deleted;         // Fixes deleted
+      uint32_t peak;            // Peak pack queue length
+      uint32_t scans;           // Calls to findmax
+      float dsq;                // Max deviation squared of deleted fixes
+      uint64_t us;              // Time packing
+   } stats;
+};
+
+float pack_dist2 (pack_t * p, fix_t * A, fix_t * B);    // Square of distance between two fixes
+float pack_linedist2 (pack_t * p, fix_t * A, fix_t * B, fix_t * C, float b2);  // Square of distance of C from line A to B
+float pack_sed2 (fix_t * A, fix_t * B, fix_t * C);      // Square of distance of C from where expected at its time on line A to B
+fix_t *pack_findmax (pack_t * p, fix_t * A, fix_t * B, float *dsqp);    // Find furthest fix from line A to B
+fix_t *pack_step (pack_t * p, fix_t * A, fix_t * B, uint8_t more);      // Pack A to B, return fix to output up to, or NULL to wait for more
+void pack_done (pack_t * p, fix_t * X);        // Stats for a fix output from packing
@@ -0,0 +1,329 @@
+// GPS logger SD log file writing, in whole aligned buffers
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+// The buffer is the FAT allocation unit size, so each write to the card is a whole cluster at a cluster boundary
+// There are two buffers, full buffers are written by a separate task, so sd_task carries on filling the other
+// If compressing, the gzip stream is what goes in the buffers, so card writes are still whole blocks
+// The SHA-256 of what goes in the buffers is worked out as it goes, so the upload can be checked without reading it again
+
+#include <revk.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "esp_heap_caps.h"
+#include "mbedtls/sha256.h"
+#include "sdlog.h"
+#include "logz.h"
+
+sdlog_stats_t sdlog_stats = { 0 };
+sdlog_stats_t sdlog_total = { 0 };
+static uint8_t sdlog_hash[SDLOG_SHA256];        // SHA-256 of last log file closed
+static uint8_t sdlog_hashed = 0;        // sdlog_hash is valid
+
+typedef struct sdlog_s sdlog_t;
+struct sdlog_s
+{
+   int fd;                      // File
+   uint8_t *buf[2];             // Buffers (aligned, DMA capable), second may be NULL if not enough memory
+   uint8_t cur;                 // Buffer being filled
+   uint8_t error:1;             // Write failed in writer task
+   uint32_t size;               // Buffer size
+   uint32_t len;                // Bytes in buffer
+   uint32_t prealloc;           // Bytes preallocated
+   off_t pos;                   // File position of buffer
+   logz_t *z;                   // Compression, if compressing
+   mbedtls_sha256_context sha;  // SHA-256 of file so far
+   SemaphoreHandle_t idle;      // Writer task not writing for us
+};
+
+typedef struct sdlog_job_s sdlog_job_t;
+struct sdlog_job_s
+{                               // Buffer for writer task
+   sdlog_t *s;
+   uint8_t *buf;
+   uint32_t len;
+};
+
+static FILE *sdlog_file = NULL; // Current log file, if ours
+static sdlog_t *sdlog_current = NULL;
+static QueueHandle_t sdlog_queue = NULL;
+
+static void
+sdlog_count (sdlog_stats_t * t, uint32_t us, uint32_t len, uint8_t ok)
+{                               // Count a write
+   t->us += us;
+   if (us > t->maxus)
+      t->maxus = us;
+   t->writes++;
+   if (ok)
+      t->written += len;
+   else
+      t->errors++;
+   int b = 0;
+   while (b < SDLOG_HIST - 1 && us >= (1000UL << b))
+      b++;
+   t->hist[b]++;
+}
+
+static int
+sdlog_card (sdlog_t * s, uint8_t * buf, uint32_t len)
+{                               // Write to card
+   int64_t start = esp_timer_get_time ();
+   int l = write (s->fd, buf, len);
+   uint32_t us = esp_timer_get_time () - start;
+   sdlog_count (&sdlog_stats, us, len, l == len);
+   sdlog_count (&sdlog_total, us, len, l == len);
+   return l == len ? 0 : -1;
+}
+
+static void
+sdlog_synced (sdlog_stats_t * t, uint32_t us)
+{                               // Count a sync
+   t->syncs++;
+   t->syncus += us;
+   if (us > t->maxsyncus)
+      t->maxsyncus = us;
+}
+
+uint32_t
+sdlog_percentile (const sdlog_stats_t * s, int pct)
+{
+   uint64_t want = ((uint64_t) s->writes * pct + 99) / 100,
+      n = 0;
+   for (int b = 0; b < SDLOG_HIST; b++)
+      if ((n += s->hist[b]) >= want)
+         return b < SDLOG_HIST - 1 ? 1 << b : (s->maxus + 999) / 1000;
+   return 0;
+}
+
+static void
+sdlog_task (void *z)
+{                               // Writer
+   sdlog_job_t j;
+   while (1)
+      if (xQueueReceive (sdlog_queue, &j, portMAX_DELAY))
+      {
+         if (sdlog_card (j.s, j.buf, j.len))
+            j.s->error = 1;
+         xSemaphoreGive (j.s->idle);
+      }
+}
+
+static void
+sdlog_wait (sdlog_t * s)
+{                               // Wait for writer task to finish with our last buffer
+   int64_t start = esp_timer_get_time ();
+   xSemaphoreTake (s->idle, portMAX_DELAY);
+   uint32_t us = esp_timer_get_time () - start;
+   sdlog_stats.stallus += us;
+   if (us > sdlog_stats.maxstallus)
+      sdlog_stats.maxstallus = us;
+}
+
+static int
+sdlog_flush (sdlog_t * s, uint8_t partial)
+{                               // Write buffer to card, if partial the block is kept and written again when full, so writes stay whole aligned blocks
+   if (!s->len)
+      return 0;
+   if (!partial && s->buf[1])
+   {                            // Hand to writer task and swap buffers
+      sdlog_wait (s);
+      if (s->error)
+      {
+         s->len = 0;
+         xSemaphoreGive (s->idle);
+         return -1;
+      }
+      sdlog_job_t j = {.s = s,.buf = s->buf[s->cur],.len = s->len };
+      xQueueSend (sdlog_queue, &j, portMAX_DELAY);
+      s->cur ^= 1;
+      s->pos += s->len;
+      s->len = 0;
+      return 0;
+   }
+   // Directly, after anything the writer task is doing
+   sdlog_wait (s);
+   int e = (s->error || sdlog_card (s, s->buf[s->cur], s->len)) ? -1 : 0;
+   if (partial && !e)
+      lseek (s->fd, s->pos, SEEK_SET);
+   else
+   {
+      s->pos += s->len;
+      s->len = 0;
+   }
+   xSemaphoreGive (s->idle);
+   return e;
+}
+
+static int
+sdlog_put (void *cookie, const uint8_t * buf, size_t size)
+{                               // Add to buffer, writing whole buffers
+   sdlog_t *s = cookie;
+   int64_t start = esp_timer_get_time ();
+   mbedtls_sha256_update (&s->sha, buf, size);
+   sdlog_stats.hashus += esp_timer_get_time () - start;
+   size_t done = 0;
+   while (done < size)
+   {
+      size_t l = s->size - s->len;
+      if (l > size - done)
+         l = size - done;
+      memcpy (s->buf[s->cur] + s->len, buf + done, l);
+      s->len += l;
+      done += l;
+      if (s->len == s->size && sdlog_flush (s, 0))
+         return -1;
+   }
+   sdlog_stats.bytes += size;
+   sdlog_total.bytes += size;
+   return 0;
+}
+
+static ssize_t
+sdlog_write (void *cookie, const char *buf, size_t size)
+{
+   sdlog_t *s = cookie;
+   int e;
+   if (s->z)
+   {
+      int64_t start = esp_timer_get_time ();
+      e = logz_write (s->z, buf, size);
+      sdlog_stats.zus += esp_timer_get_time () - start;
+   } else
+      e = sdlog_put (s, (const uint8_t *) buf, size);
+   if (e)
+   {
+      errno = EIO;
+      return -1;
+   }
+   sdlog_stats.raw += size;
+   return size;
+}
+
+static void
+sdlog_free (sdlog_t * s)
+{
+   if (s->idle)
+      vSemaphoreDelete (s->idle);
+   logz_free (s->z);
+   mbedtls_sha256_free (&s->sha);
+   heap_caps_free (s->buf[0]);
+   heap_caps_free (s->buf[1]);
+   free (s);
+}
+
+static int
+sdlog_close (void *cookie)
+{
+   sdlog_t *s = cookie;
+   if (s == sdlog_current)
+   {
+      sdlog_current = NULL;
+      sdlog_file = NULL;
+   }
+   int e = 0;
+   if (s->z)
+   {                            // End of gzip stream
+      int64_t start = esp_timer_get_time ();
+      e = logz_finish (s->z);
+      s->z = NULL;
+      sdlog_stats.zus += esp_timer_get_time () - start;
+   }
+   if (sdlog_flush (s, 0))
+      e = -1;
+   sdlog_wait (s);              // Last write done
+   if (s->error)
+      e = -1;
+   if (s->prealloc)
+      ftruncate (s->fd, sdlog_stats.bytes);     // Preallocated space not used
+   if (close (s->fd))
+      e = -1;
+   if (!e && !mbedtls_sha256_finish (&s->sha, sdlog_hash))
+      sdlog_hashed = 1;
+   sdlog_free (s);
+   return e;
+}
+
+FILE *
+sdlog_open (const char *filename, uint32_t bufsize, uint32_t prealloc, uint8_t gzip)
+{
+   memset (&sdlog_stats, 0, sizeof (sdlog_stats));
+   sdlog_hashed = 0;
+   if (!bufsize && !gzip)
+      return fopen (filename, "w");
+   if (!bufsize)
+      bufsize = 4096;           // Compression needs our buffer
+   if (!sdlog_queue)
+   {
+      sdlog_queue = xQueueCreate (1, sizeof (sdlog_job_t));
+      revk_task ("SDWrite", sdlog_task, NULL, 4);
+   }
+   sdlog_t *s = mallocspi (sizeof (*s));
+   if (!s)
+      return NULL;
+   memset (s, 0, sizeof (*s));
+   mbedtls_sha256_init (&s->sha);
+   mbedtls_sha256_starts (&s->sha, 0);
+   s->size = bufsize;
+   s->idle = xSemaphoreCreateBinary ();
+   s->buf[0] = heap_caps_aligned_alloc (4, bufsize, MALLOC_CAP_DMA);
+   if (!s->idle || !s->buf[0])
+   {                            // Not ideal, but carry on as normal file, unless compressing
+      sdlog_free (s);
+      return gzip ? NULL : fopen (filename, "w");
+   }
+   xSemaphoreGive (s->idle);
+   s->buf[1] = heap_caps_aligned_alloc (4, bufsize, MALLOC_CAP_DMA);    // If this fails, all writes are direct
+   s->fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if (s->fd < 0)
+   {
+      sdlog_free (s);
+      return NULL;
+   }
+   if (prealloc && lseek (s->fd, prealloc - 1, SEEK_SET) == prealloc - 1 && write (s->fd, "", 1) == 1)
+      s->prealloc = prealloc;   // Clusters allocated now, file truncated to what was written at the end
+   lseek (s->fd, 0, SEEK_SET);
+   if (gzip && !(s->z = logz_init (gzip, sdlog_put, s)))
+   {
+      close (s->fd);
+      unlink (filename);
+      sdlog_free (s);
+      return NULL;
+   }
+   cookie_io_functions_t io = {.write = sdlog_write,.close = sdlog_close };
+   FILE *o = fopencookie (s, "w", io);
+   if (!o)
+   {
+      close (s->fd);
+      sdlog_free (s);
+      return NULL;
+   }
+   sdlog_file = o;
+   sdlog_current = s;
+   return o;
+}
+
+int
+sdlog_sync (FILE * o)
+{                               // Checkpoint
+   int64_t start = esp_timer_get_time ();
+   int e = fflush (o);
+   if (o == sdlog_file)
+   {
+      if (sdlog_flush (sdlog_current, 1) || fsync (sdlog_current->fd))
+         e = -1;
+   } else if (fsync (fileno (o)))
+      e = -1;
+   uint32_t us = esp_timer_get_time () - start;
+   sdlog_synced (&sdlog_stats, us);
+   sdlog_synced (&sdlog_total, us);
+   return e;
+}
+
+int
+sdlog_sha256 (uint8_t sha256[SDLOG_SHA256])
+{
+   if (!sdlog_hashed)
+      return -1;
+   memcpy (sha256, sdlog_hash, SDLOG_SHA256);
+   return 0;
+}
@@ -0,0 +1,41 @@
+// GPS logger SD log file writing, in whole aligned buffers
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+
+#ifndef	SDLOG_H
+#define	SDLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define	SDLOG_HIST	16      // Write latency histogram buckets, 1ms, 2ms, 4ms... and last is anything longer
+#define	SDLOG_SHA256	32      // SHA-256 size
+
+typedef struct sdlog_stats_s sdlog_stats_t;
+struct sdlog_stats_s
+{                               // Stats for log file
+   uint64_t bytes;              // Bytes written to file
+   uint64_t written;            // Bytes written to card, more than bytes if partial blocks written again after checkpoints
+   uint32_t writes;             // Writes to card
+   uint32_t errors;             // Failed writes
+   uint64_t us;                 // Time writing (card busy)
+   uint32_t maxus;              // Longest write
+   uint64_t stallus;            // Time waiting for a previous write to finish (i.e. held up by card)
+   uint32_t maxstallus;         // Longest wait
+   uint32_t syncs;              // Checkpoints (sync to card)
+   uint64_t syncus;             // Time syncing
+   uint32_t maxsyncus;          // Longest sync
+   uint32_t hist[SDLOG_HIST];   // Writes by latency, bucket n is under 1ms<<n
+   uint64_t raw;                // Bytes before compression
+   uint64_t zus;                // Time compressing
+   uint64_t hashus;             // Time hashing
+};
+
+extern sdlog_stats_t sdlog_stats;       // Stats for current (or last) log file
+extern sdlog_stats_t sdlog_total;       // Stats for all log files since boot (not raw, zus, hashus, or stall)
+
+FILE *sdlog_open (const char *filename, uint32_t bufsize, uint32_t prealloc, uint8_t gzip);     // Open log file for writing in bufsize blocks (0 for normal stdio), prealloc bytes, gzip level (0 for none)
+uint32_t sdlog_percentile (const sdlog_stats_t * s, int pct);   // Write latency (ms) that pct% of writes were within, to histogram resolution
+int sdlog_sync (FILE * o);        // Checkpoint, everything written so far is on the card (not if compressing)
+int sdlog_sha256 (uint8_t sha256[SDLOG_SHA256]);        // SHA-256 of last log file closed, as on the card, -1 if not known (normal stdio file, or failed)
+
+#endif
@@ -0,0 +1,336 @@
+// GPS logger SD file reading, with read ahead, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+// There are two buffers, whilst one is being used the next part of the file is read in to the other by a separate task,
+// so reading the card overlaps what is done with the data, e.g. TLS and sending. Each card read is a whole buffer, so
+// FAT reads many sectors at once rather than a stdio buffer at a time.
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "sdread.h"
+#ifdef	ESP_PLATFORM
+#include <revk.h>
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#define	sdread_alloc(n)	(heap_caps_aligned_alloc(4,n,MALLOC_CAP_SPIRAM)?:heap_caps_aligned_alloc(4,n,MALLOC_CAP_DMA))
+#define	sdread_free(p)	heap_caps_free(p)
+typedef off_t sdread_off_t;
+#else
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#define	sdread_alloc(n)	malloc(n)
+#define	sdread_free(p)	free(p)
+typedef off64_t sdread_off_t;
+ssize_t (*sdread_card_read) (int fd, void *buf, size_t len) = NULL;
+#endif
+
+sdread_stats_t sdread_stats = { 0 };
+
+typedef struct sdread_s sdread_t;
+struct sdread_s
+{
+   int fd;                      // File
+   uint8_t *buf[2];             // Buffers
+   uint32_t size;               // Buffer size
+   uint32_t len[2];             // Bytes read in to buffer, less than size at end of file
+   uint8_t cur;                 // Buffer being used
+   uint8_t ready:1;             // Buffer being used has been read
+   uint8_t ahead:1;             // Read task has a read for us
+   uint8_t error;               // Read failed, set by read task, so not a bit field next to ours
+   uint32_t pos;                // Position in buffer being used
+   off_t base;                  // File position of buffer being used
+   off_t next;                  // File position of next read
+#ifdef	ESP_PLATFORM
+   SemaphoreHandle_t done;      // Read task has finished a read for us
+#else
+   sem_t done;
+#endif
+};
+
+typedef struct sdread_job_s sdread_job_t;
+struct sdread_job_s
+{                               // Read for reader task
+   sdread_t *r;
+   off_t pos;
+   uint8_t n;
+};
+
+#define	SDREAD_JOBS	4       // Reads queued, one per file, i.e. file being sent and next file opened ahead
+#ifdef	ESP_PLATFORM
+static QueueHandle_t sdread_queue = NULL;
+#else
+static pthread_mutex_t sdread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sdread_cond = PTHREAD_COND_INITIALIZER;
+static sdread_job_t sdread_jobs[SDREAD_JOBS];
+static int sdread_head = 0,
+   sdread_count = -1;
+#endif
+
+static int64_t
+sdread_now (void)
+{                               // us
+#ifdef	ESP_PLATFORM
+   return esp_timer_get_time ();
+#else
+   struct timespec t;
+   clock_gettime (CLOCK_MONOTONIC, &t);
+   return (int64_t) t.tv_sec * 1000000LL + t.tv_nsec / 1000;
+#endif
+}
+
+static ssize_t
+sdread_get (int fd, uint8_t * buf, size_t len)
+{
+#ifndef	ESP_PLATFORM
+   if (sdread_card_read)
+      return sdread_card_read (fd, buf, len);
+#endif
+   return read (fd, buf, len);
+}
+
+static void
+sdread_card (sdread_job_t * j)
+{                               // Read from card, a whole buffer unless end of file
+   sdread_t *r = j->r;
+   int64_t start = sdread_now ();
+   ssize_t got = 0,
+      l = 0;
+   if (lseek (r->fd, j->pos, SEEK_SET) != j->pos)
+      l = -1;
+   else
+      while (got < r->size && (l = sdread_get (r->fd, r->buf[j->n] + got, r->size - got)) > 0)
+         got += l;
+   sdread_stats.us += sdread_now () - start;
+   sdread_stats.reads++;
+   if (l < 0)
+   {
+      sdread_stats.errors++;
+      r->error = 1;
+      got = 0;
+   }
+   sdread_stats.bytes += got;
+   r->len[j->n] = got;
+#ifdef	ESP_PLATFORM
+   xSemaphoreGive (r->done);
+#else
+   sem_post (&r->done);
+#endif
+}
+
+#ifdef	ESP_PLATFORM
+static void
+sdread_task (void *z)
+{                               // Reader
+   sdread_job_t j;
+   while (1)
+      if (xQueueReceive (sdread_queue, &j, portMAX_DELAY))
+         sdread_card (&j);
+}
+#else
+static void *
+sdread_task (void *)
+{                               // Reader
+   while (1)
+   {
+      pthread_mutex_lock (&sdread_mutex);
+      while (!sdread_count)
+         pthread_cond_wait (&sdread_cond, &sdread_mutex);
+      sdread_job_t j = sdread_jobs[sdread_head];
+      sdread_head = (sdread_head + 1) % SDREAD_JOBS;
+      sdread_count--;
+      pthread_cond_broadcast (&sdread_cond);
+      pthread_mutex_unlock (&sdread_mutex);
+      sdread_card (&j);
+   }
+   return NULL;
+}
+#endif
+
+static void
+sdread_start (sdread_t * r, uint8_t n)
+{                               // Start reading next part of file in to buffer n
+   sdread_job_t j = {.r = r,.pos = r->next,.n = n };
+   r->next += r->size;
+   r->ahead = 1;
+#ifdef	ESP_PLATFORM
+   xQueueSend (sdread_queue, &j, portMAX_DELAY);
+#else
+   pthread_mutex_lock (&sdread_mutex);
+   while (sdread_count == SDREAD_JOBS)
+      pthread_cond_wait (&sdread_cond, &sdread_mutex);
+   sdread_jobs[(sdread_head + sdread_count++) % SDREAD_JOBS] = j;
+   pthread_cond_broadcast (&sdread_cond);
+   pthread_mutex_unlock (&sdread_mutex);
+#endif
+}
+
+static void
+sdread_wait (sdread_t * r)
+{                               // Wait for read task to finish our read, if any
+   if (!r->ahead)
+      return;
+   int64_t start = sdread_now ();
+#ifdef	ESP_PLATFORM
+   xSemaphoreTake (r->done, portMAX_DELAY);
+#else
+   while (sem_wait (&r->done) && errno == EINTR);
+#endif
+   sdread_stats.stallus += sdread_now () - start;
+   r->ahead = 0;
+}
+
+static ssize_t
+sdread_read (void *cookie, char *buf, size_t size)
+{
+   sdread_t *r = cookie;
+   size_t done = 0;
+   while (done < size)
+   {
+      if (!r->ready)
+      {                         // Wait for buffer, and start reading the next in to the other one
+         sdread_wait (r);
+         if (r->error)
+         {
+            errno = EIO;
+            return done ? (ssize_t) done : -1;
+         }
+         r->ready = 1;
+         r->pos = 0;
+         if (r->len[r->cur] == r->size)
+            sdread_start (r, r->cur ^ 1);
+      }
+      if (r->pos == r->len[r->cur])
+      {                         // Used this buffer
+         if (r->len[r->cur] < r->size)
+            break;              // End of file
+         r->base += r->size;
+         r->cur ^= 1;
+         r->ready = 0;
+         continue;
+      }
+      size_t l = r->len[r->cur] - r->pos;
+      if (l > size - done)
+         l = size - done;
+      memcpy (buf + done, r->buf[r->cur] + r->pos, l);
+      r->pos += l;
+      done += l;
+   }
+   return done;
+}
+
+static int
+sdread_seek (void *cookie, sdread_off_t * offset, int whence)
+{                               // Reading starts again from new position
+   sdread_t *r = cookie;
+   off_t p = *offset;
+   if (whence == SEEK_CUR)
+      p += r->base + (r->ready ? r->pos : 0);
+   else if (whence == SEEK_END)
+   {
+      struct stat s;
+      if (fstat (r->fd, &s))
+         return -1;
+      p += s.st_size;
+   }
+   if (p < 0)
+   {
+      errno = EINVAL;
+      return -1;
+   }
+   sdread_wait (r);
+   r->cur = 0;
+   r->ready = 0;
+   r->error = 0;
+   r->base = r->next = p;
+   sdread_start (r, 0);
+   *offset = p;
+   return 0;
+}
+
+static void
+sdread_release (sdread_t * r)
+{
+#ifdef	ESP_PLATFORM
+   if (r->done)
+      vSemaphoreDelete (r->done);
+#else
+   sem_destroy (&r->done);
+#endif
+   sdread_free (r->buf[0]);
+   sdread_free (r->buf[1]);
+   free (r);
+}
+
+static int
+sdread_close (void *cookie)
+{
+   sdread_t *r = cookie;
+   sdread_wait (r);             // Read task done with our buffers
+   int e = close (r->fd);
+   sdread_release (r);
+   return e;
+}
+
+FILE *
+sdread_open (const char *filename, uint32_t bufsize)
+{
+   if (!bufsize)
+      return fopen (filename, "r");
+#ifdef	ESP_PLATFORM
+   if (!sdread_queue)
+   {
+      sdread_queue = xQueueCreate (SDREAD_JOBS, sizeof (sdread_job_t));
+      revk_task ("SDRead", sdread_task, NULL, 4);
+   }
+#else
+   pthread_mutex_lock (&sdread_mutex);
+   if (sdread_count < 0)
+   {
+      pthread_t t;
+      sdread_count = 0;
+      pthread_create (&t, NULL, sdread_task, NULL);
+      pthread_detach (t);
+   }
+   pthread_mutex_unlock (&sdread_mutex);
+#endif
+   sdread_t *r = malloc (sizeof (*r));
+   if (!r)
+      return NULL;
+   memset (r, 0, sizeof (*r));
+   r->size = bufsize;
+   r->buf[0] = sdread_alloc (bufsize);
+   r->buf[1] = sdread_alloc (bufsize);
+#ifdef	ESP_PLATFORM
+   r->done = xSemaphoreCreateBinary ();
+   if (!r->done || !r->buf[0] || !r->buf[1])
+#else
+   if (sem_init (&r->done, 0, 0) || !r->buf[0] || !r->buf[1])
+#endif
+   {                            // Not ideal, but carry on as normal file
+      sdread_release (r);
+      return fopen (filename, "r");
+   }
+   r->fd = open (filename, O_RDONLY);
+   if (r->fd < 0)
+   {
+      sdread_release (r);
+      return NULL;
+   }
+   cookie_io_functions_t io = {.read = sdread_read,.seek = sdread_seek,.close = sdread_close };
+   FILE *i = fopencookie (r, "r", io);
+   if (!i)
+   {
+      close (r->fd);
+      sdread_release (r);
+      return NULL;
+   }
+#ifdef	ESP_PLATFORM
+   setvbuf (i, NULL, _IONBF, 0);        // Our buffers are enough, newlib then reads straight in to the caller's buffer
+#endif
+   sdread_start (r, 0);         // Start reading now, so first buffer may be ready by the time it is wanted
+   return i;
+}
@@ -0,0 +1,29 @@
+// GPS logger SD file reading, with read ahead, shared with host tools
+// Copyright (c) 2019-2024 Adrian Kennard, Andrews & Arnold Limited, see LICENSE file (GPL)
+
+#ifndef	SDREAD_H
+#define	SDREAD_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct sdread_stats_s sdread_stats_t;
+struct sdread_stats_s
+{                               // Stats for files read since last cleared
+   uint64_t bytes;              // Bytes read from card
+   uint32_t reads;              // Reads from card
+   uint32_t errors;             // Failed reads
+   uint64_t us;                 // Time reading (card busy)
+   uint64_t stallus;            // Time waiting for a read to finish (i.e. held up by card)
+};
+
+extern sdread_stats_t sdread_stats;
+
+FILE *sdread_open (const char *filename, uint32_t bufsize);     // Open file for reading, next bufsize block read by a separate task whilst this one is used (0 for normal stdio)
+
+#ifndef	ESP_PLATFORM
+#include <sys/types.h>
+extern ssize_t (*sdread_card_read) (int fd, void *buf, size_t len);    // Host only, replaces card reads, for simulating card speed
+#endif
+
+#endif
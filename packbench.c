@@ -0,0 +1,325 @@
+// Pack benchmark - run point reduction on recorded JSON journeys, report and check against golden results
+
+#include <stdio.h>
+#include <string.h>
+#include <popt.h>
+#include <time.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <err.h>
+#include <ajl.h>
+#include <math.h>
+#include "pack.h"
+#include "jsonfix.h"
+#include "rdp.h"
+
+int debug = 0;
+int packmin = 60;
+int packmax = 600;
+int repeat = 1;
+double timescale = 10.0;
+
+int
+load (const char *fn, fix_t ** fixesp)
+{                               // Load fixes with ECEF and time, as packing on device only gets these
+   *fixesp = NULL;
+   j_t j = j_create ();
+   const char *e = j_read_file (j, fn);
+   if (e)
+   {
+      warnx ("Failed %s: %s", fn, e);
+      j_delete (&j);
+      return 0;
+   }
+   int n = 0;
+   for (j_t g = j_first (j_find (j, "gps")); g; g = j_next (g))
+      n++;
+   fix_t *fixes = calloc (n ? : 1, sizeof (*fixes));
+   if (!fixes)
+      errx (1, "malloc");
+   n = 0;
+   for (j_t g = j_first (j_find (j, "gps")); g; g = j_next (g))
+   {
+      fix_t *f = &fixes[n];
+      json_fix (g, f, NULL);
+      if (!f->setecef || !j_get (g, "ecef.t"))
+         continue;              // Packing needs ECEF and time
+      n++;
+      if (!f->seq)
+         f->seq = n;
+   }
+   j_delete (&j);
+   *fixesp = fixes;
+   return n;
+}
+
+void
+reset (fix_t * fixes, int n)
+{
+   for (int i = 0; i < n; i++)
+   {
+      fixes[i].next = (i + 1 < n ? &fixes[i + 1] : NULL);
+      fixes[i].corner = 0;
+      fixes[i].deleted = 0;
+      fixes[i].dsq = NAN;
+   }
+}
+
+void
+dopack (pack_t * p, fix_t * fixes, int n)
+{                               // As pack_task, fixes arriving whilst moving, then stopped at end
+   fix_t *base = NULL,
+      *last = NULL;
+   uint32_t count = 0;
+   uint32_t packtry = packmin;
+   void out (fix_t * E)
+   {
+      while (base && base != E)
+      {
+         fix_t *X = base;
+         base = X->next;
+         X->next = NULL;
+         count--;
+         pack_done (p, X);
+      }
+      if (!base)
+         last = NULL;
+   }
+   for (int i = 0; i < n; i++)
+   {
+      fix_t *f = &fixes[i];
+      f->next = NULL;
+      if (base)
+         last->next = f;
+      else
+         base = f;
+      last = f;
+      count++;
+      while (count >= 2 && count >= packtry)
+      {
+         if (count > p->stats.peak)
+            p->stats.peak = count;
+         fix_t *E = pack_step (p, base, last, count < packmax);
+         if (!E)
+         {
+            packtry += packmin;
+            break;
+         }
+         packtry = packmin;
+         out (E);
+      }
+   }
+   while (count >= 2)
+      out (pack_step (p, base, last, 0));
+}
+
+void
+measure (fix_t * fixes, int n, uint32_t * keptp, double *maxp, double *meanp, double *maxsedp, double *meansedp)
+{                               // Spatial and synchronous (SED) deviation (metres) of dropped fixes from the kept track
+   pack_t m = { 0 };            // No time component
+   uint32_t kept = 0,
+      dropped = 0;
+   double max = 0,
+      total = 0,
+      maxsed = 0,
+      totalsed = 0;
+   fix_t *K = NULL;
+   for (int i = 0; i < n; i++)
+   {
+      if (fixes[i].deleted && !fixes[i].waypoint && i + 1 < n)
+         continue;
+      kept++;
+      if (K)
+      {
+         float b2 = pack_dist2 (&m, &fixes[i], K);
+         for (fix_t * C = K + 1; C < &fixes[i]; C++)
+         {
+            float h2 = pack_linedist2 (&m, K, &fixes[i], C, b2);
+            double d = (h2 > 0 ? sqrt (h2) : 0);
+            if (d > max)
+               max = d;
+            total += d;
+            d = sqrt (pack_sed2 (K, &fixes[i], C));
+            if (d > maxsed)
+               maxsed = d;
+            totalsed += d;
+            dropped++;
+         }
+      }
+      K = &fixes[i];
+   }
+   *keptp = kept;
+   *maxp = max;
+   *meanp = (dropped ? total / dropped : 0);
+   *maxsedp = maxsed;
+   *meansedp = (dropped ? totalsed / dropped : 0);
+}
+
+int
+main (int argc, const char *argv[])
+{
+   const char *dists = "1,2,5,10,20";
+   const char *times = "0,10,60";
+   const char *golden = NULL;
+   int update = 0;
+   poptContext optCon;          // context for parsing command-line options
+   {                            // POPT
+      const struct poptOption optionsTable[] = {
+         {"dist", 'd', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &dists, 0, "packdist values", "m,m..."},
+         {"time", 't', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &times, 0, "packtime values", "s,s..."},
+         {"min", 0, POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &packmin, 0, "packmin", "N"},
+         {"max", 0, POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &packmax, 0, "packmax", "N"},
+         {"timescale", 0, POPT_ARG_DOUBLE | POPT_ARGFLAG_SHOW_DEFAULT, &timescale, 0, "json2gpx --rdp scale for metres to seconds", "M"},
+         {"repeat", 'n', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &repeat, 0, "Runs for timing", "N"},
+         {"golden", 'g', POPT_ARG_STRING, &golden, 0, "Check results against golden file", "filename"},
+         {"update", 'u', POPT_ARG_NONE, &update, 0, "Write results to golden file"},
+         {"debug", 'v', POPT_ARG_NONE, &debug, 0, "Debug"},
+         POPT_AUTOHELP {}
+      };
+
+      optCon = poptGetContext (NULL, argc, argv, optionsTable, 0);
+      poptSetOtherOptionHelp (optCon, "[jsonfiles]");
+
+      int c;
+      if ((c = poptGetNextOpt (optCon)) < -1)
+         errx (1, "%s: %s\n", poptBadOption (optCon, POPT_BADOPTION_NOALIAS), poptStrerror (c));
+
+      if (!poptPeekArg (optCon))
+      {
+         poptPrintUsage (optCon, stderr, 0);
+         return -1;
+      }
+      if (update && !golden)
+         errx (1, "--update needs --golden");
+      if (packmin < 2 || packmax < packmin || repeat < 1)
+         errx (1, "Bad --min/--max/--repeat");
+   }
+   // Results, one line per file/variant/setting, timing excluded so can be compared
+   char *results = NULL;
+   size_t resultslen = 0;
+   FILE *r = open_memstream (&results, &resultslen);
+   const struct
+   {
+      const char *name;
+      uint8_t rdp:1;
+      uint8_t sed:1;
+   } variants[] = {
+      {"pack"},
+      {"rdp",.rdp = 1},
+      {"sed",.sed = 1},
+   };
+   const char *fn;
+   while ((fn = poptGetArg (optCon)))
+   {
+      fix_t *fixes = NULL;
+      int n = load (fn, &fixes);
+      if (!n)
+      {
+         warnx ("No ECEF fixes in %s", fn);
+         free (fixes);
+         continue;
+      }
+      const char *name = strrchr (fn, '/');
+      name = name ? name + 1 : fn;
+      uint64_t hash = 14695981039346656037ULL;  // FNV-1a of fixes as loaded, so a JSON parser difference shows as such, not as a packing change
+      for (int i = 0; i < n; i++)
+      {
+         int64_t v[] = { fixes[i].ecef.x, fixes[i].ecef.y, fixes[i].ecef.z, fixes[i].ecef.t };
+         for (int k = 0; k < sizeof (v) / sizeof (*v); k++)
+            for (int b = 0; b < 64; b += 8)
+               hash = (hash ^ (((uint64_t) v[k] >> b) & 0xFF)) * 1099511628211ULL;
+      }
+      fprintf (r, "%s load fixes=%d ecef=%016llx\n", name, n, (unsigned long long) hash);
+      for (int v = 0; v < sizeof (variants) / sizeof (*variants); v++)
+         for (const char *d = dists; *d; d += strcspn (d, ","), d += (*d == ','))
+            for (const char *t = times; *t; t += strcspn (t, ","), t += (*t == ','))
+            {
+               pack_t p = {.dist = atoi (d),.time = atoi (t),.sed = variants[v].sed };
+               if (!p.dist)
+                  continue;
+               if (p.sed || variants[v].rdp)
+               {                // Time not used (rdp has --timescale)
+                  if (t != times)
+                     continue;
+                  p.time = 0;
+               }
+               struct timespec start,
+                 end;
+               clock_gettime (CLOCK_MONOTONIC, &start);
+               for (int i = 0; i < repeat; i++)
+               {
+                  reset (fixes, n);
+                  memset (&p.stats, 0, sizeof (p.stats));
+                  p.P = NULL;
+                  if (variants[v].rdp)
+                     rdp (&fixes[0], NULL, p.dist, timescale);   // As json2gpx --rdp
+                  else
+                     dopack (&p, fixes, n);
+               }
+               clock_gettime (CLOCK_MONOTONIC, &end);
+               double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+               uint32_t kept = 0;
+               double max = 0,
+                  mean = 0,
+                  maxsed = 0,
+                  meansed = 0;
+               measure (fixes, n, &kept, &max, &mean, &maxsed, &meansed);
+               fprintf (r, "%s %s dist=%d time=%d fixes=%d kept=%u scans=%u maxdev=%.3f meandev=%.3f maxsed=%.3f meansed=%.3f\n", name,
+                        variants[v].name, p.dist, p.time, n, kept, p.stats.scans, max, mean, maxsed, meansed);
+               fprintf (stderr, "%-30s %-4s dist=%-3d time=%-3d %6d->%-6u %8.3fm %8.3fm %8.3fm %8.3fm %10.0f fixes/s\n", name,
+                        variants[v].name, p.dist, p.time, n, kept, max, mean, maxsed, meansed, secs > 0 ? n * repeat / secs : 0);
+            }
+      free (fixes);
+   }
+   fclose (r);
+   int ret = 0;
+   if (golden && update)
+   {
+      FILE *o = fopen (golden, "w");
+      if (!o)
+         err (1, "Cannot open %s", golden);
+      fwrite (results, resultslen, 1, o);
+      fclose (o);
+   } else if (golden)
+   {                            // Check
+      FILE *i = fopen (golden, "r");
+      if (!i)
+         err (1, "Cannot open %s", golden);
+      char *expect = NULL;
+      size_t expectlen = 0;
+      FILE *e = open_memstream (&expect, &expectlen);
+      char buf[1024];
+      size_t l;
+      while ((l = fread (buf, 1, sizeof (buf), i)) > 0)
+         fwrite (buf, l, 1, e);
+      fclose (e);
+      fclose (i);
+      char *a = results,
+         *b = expect;
+      while (*a || *b)
+      {
+         size_t al = strcspn (a, "\n"),
+            bl = strcspn (b, "\n");
+         if (al != bl || strncmp (a, b, al))
+         {
+            if (bl)
+               fprintf (stderr, "-%.*s\n", (int) bl, b);
+            if (al)
+               fprintf (stderr, "+%.*s\n", (int) al, a);
+            ret = 1;
+         }
+         a += al + (a[al] == '\n');
+         b += bl + (b[bl] == '\n');
+      }
+      free (expect);
+      if (ret)
+         warnx ("Results differ from %s", golden);
+      else if (debug)
+         warnx ("Results match %s", golden);
+   } else
+      fwrite (results, resultslen, 1, stdout);
+   free (results);
+   poptFreeContext (optCon);
+   return ret;
+}
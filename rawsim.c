@@ -0,0 +1,277 @@
+// Raw log region simulation - journeys written as on device to a file as block device, with throughput, and power lost part way
+// Power loss stops card writes at a sector, that sector left as rubbish, and the journey read back must be what was written,
+// up to at least the last checkpoint
+
+#include <stdio.h>
+#include <string.h>
+#include <popt.h>
+#include <time.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include "lograw.h"
+#include "logconv.h"
+
+#define	SECTOR	512
+
+int debug = 0;
+int sector = 0;                 // Sectors written
+int cut = -1;                   // Sectors to write before power lost, -1 for no power loss
+int dead = 0;                   // Power lost
+
+int
+sim_card (int fd, off_t pos, const uint8_t * buf, size_t len)
+{                               // Card write, a sector at a time
+   if (dead)
+      return -1;
+   for (size_t s = 0; s < len; s += SECTOR)
+   {
+      if (cut >= 0 && sector == cut)
+      {                         // Power lost, this sector part written
+         uint8_t junk[SECTOR];
+         for (int i = 0; i < SECTOR; i++)
+            junk[i] = random ();
+         pwrite (fd, junk, SECTOR, pos + s);
+         dead = 1;
+         return -1;
+      }
+      if (pwrite (fd, buf + s, SECTOR, pos + s) != SECTOR)
+         return -1;
+      sector++;
+   }
+   return 0;
+}
+
+double
+now (void)
+{
+   struct timespec t;
+   clock_gettime (CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+size_t
+readall (FILE * i, uint8_t * buf, size_t max)
+{                               // Read journey
+   size_t got = 0,
+      l;
+   while (got < max && (l = fread (buf + got, 1, max - got, i)) > 0)
+      got += l;
+   return got;
+}
+
+int
+main (int argc, const char *argv[])
+{
+   const char *region = "rawsim.raw";
+   const char *logfile = NULL;
+   int size = 4;
+   int block = LOGRAW_BLOCK;
+   int trials = 1000;
+   int syncbytes = 1000;
+   int seed = 0;
+   int gpx = 0;
+   poptContext optCon;          // context for parsing command-line options
+   {                            // POPT
+      const struct poptOption optionsTable[] = {
+         {"region", 'f', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &region, 0, "Region file (block device)", "filename"},
+         {"size", 's', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &size, 0, "Region size", "MiB"},
+         {"block", 'b', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &block, 0, "Block size", "bytes"},
+         {"trials", 't', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &trials, 0, "Power loss trials", "N"},
+         {"sync", 'y', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &syncbytes, 0, "Average bytes between checkpoints", "bytes"},
+         {"seed", 0, POPT_ARG_INT, &seed, 0, "Random seed (default from time)", "N"},
+         {"log", 'l', POPT_ARG_STRING, &logfile, 0, "Binary log to write, lose power part way, and convert what is recovered to stdout",
+          "filename"},
+         {"gpx", 'g', POPT_ARG_NONE, &gpx, 0, "Convert to GPX (with --log, default JSON)"},
+         {"debug", 'v', POPT_ARG_NONE, &debug, 0, "Debug"},
+         POPT_AUTOHELP {}
+      };
+
+      optCon = poptGetContext (NULL, argc, argv, optionsTable, 0);
+
+      int c;
+      if ((c = poptGetNextOpt (optCon)) < -1)
+         errx (1, "%s: %s\n", poptBadOption (optCon, POPT_BADOPTION_NOALIAS), poptStrerror (c));
+
+      if (poptPeekArg (optCon))
+      {
+         poptPrintUsage (optCon, stderr, 0);
+         return -1;
+      }
+      if (size < 1)
+         errx (1, "Bad --size");
+      if (block < SECTOR || block % SECTOR)
+         errx (1, "Bad --block");
+      if (syncbytes < 1)
+         errx (1, "Bad --sync");
+   }
+   srandom (seed ? : time (0));
+   uint32_t bytes = size * 1024 * 1024;
+   uint32_t data = bytes / LOGRAW_SECTOR * LOGRAW_DATA;  // Capacity
+   uint8_t *in = malloc (data),
+      *out = malloc (data);
+   if (!in || !out)
+      errx (1, "malloc");
+   unlink (region);
+
+   if (logfile)
+   {                            // Real log
+      FILE *f = fopen (logfile, "r");
+      if (!f)
+         err (1, "Cannot open %s", logfile);
+      size_t len = readall (f, in, data);
+      fclose (f);
+      lograw_card = sim_card;
+      cut = 1 + random () % (len * 2 / SECTOR + 1);     // Cut somewhere after sector 0 (journey start), or finish the log
+      FILE *o = lograw_open (region, bytes, block);
+      if (!o)
+         err (1, "Cannot make %s", region);
+      size_t synced = 0;
+      for (size_t p = 0; p < len && !dead; p += 100)
+      {
+         fwrite (in + p, 1, len - p < 100 ? len - p : 100, o);
+         if (p / syncbytes != (p + 100) / syncbytes && !lograw_sync (o))
+            synced = p + 100 < len ? p + 100 : len;
+      }
+      fclose (o);
+      FILE *i = lograw_reader (region, block);
+      if (!i)
+         errx (1, "Nothing recovered");
+      int r = logconv (i, stdout, gpx ? LOGCONV_GPX : LOGCONV_JSON);
+      fclose (i);
+      fprintf (stderr, "%s: %zu bytes, %s, checkpoint at %zu, %s\n", logfile, len, dead ? "power lost" : "not lost", synced,
+               r < 0 ? "not a binary log" : r ? "recovered" : "complete");
+      poptFreeContext (optCon);
+      return 0;
+   }
+
+   for (uint32_t i = 0; i + 4 <= data; i += 4)
+      *(uint32_t *) (in + i) = random ();
+
+   {                            // Throughput, 100 byte writes, checkpoint every syncbytes, until region nearly full, as on device
+      uint32_t len = 0;
+      double t0 = now ();
+      FILE *o = lograw_open (region, bytes, block);
+      if (!o)
+         err (1, "Cannot make %s", region);
+      double t1 = now ();
+      while (len + 100 <= data && lograw_left (o) > BUFSIZ / LOGRAW_DATA + 2)
+      {
+         if (fwrite (in + len, 1, 100, o) != 100)
+            break;
+         len += 100;
+         if (len / syncbytes != (len - 100) / syncbytes)
+            lograw_sync (o);
+      }
+      fclose (o);
+      double t2 = now ();
+      printf ("Region %dMiB, block %d: make %.3fs, %u bytes in %.3fs (%.1fMiB/s), %u writes, %u checkpoints, written %llu (x%.2f)\n",
+              size, block, t1 - t0, len, t2 - t1, len / (t2 - t1) / 1024 / 1024, lograw_stats.writes, lograw_stats.syncs,
+              (unsigned long long) lograw_stats.written, (double) lograw_stats.written / len);
+      // As a normal file, with fsync at each checkpoint, for comparison
+      char *fn = NULL;
+      asprintf (&fn, "%s.file", region);
+      t1 = now ();
+      o = fopen (fn, "w");
+      if (!o)
+         err (1, "Cannot make %s", fn);
+      int syncs = 0;
+      for (uint32_t p = 100; p <= len; p += 100)
+      {
+         fwrite (in + p - 100, 1, 100, o);
+         if (p / syncbytes != (p - 100) / syncbytes)
+         {
+            fflush (o);
+            fsync (fileno (o));
+            syncs++;
+         }
+      }
+      fclose (o);
+      t2 = now ();
+      unlink (fn);
+      free (fn);
+      printf ("Normal file: %u bytes in %.3fs (%.1fMiB/s), %d fsyncs\n", len, t2 - t1, len / (t2 - t1) / 1024 / 1024, syncs);
+      FILE *i = lograw_reader (region, block);
+      if (!i || readall (i, out, data) != len || memcmp (in, out, len))
+         errx (1, "Throughput journey did not read back");
+      fclose (i);
+      lograw_done (region);
+   }
+
+   // Power loss
+   lograw_card = sim_card;
+   int fails = 0,
+      lost = 0,
+      empty = 0;
+   uint64_t lostbytes = 0;
+   for (int t = 0; t < trials; t++)
+   {
+      uint32_t len = random () % (data / 8);    // Leaving room for checkpoints, and old journeys after it
+      uint32_t wrote = 0,
+         synced = 0;
+      sector = dead = 0;
+      cut = random () % (len * 2 / SECTOR + 1);        // About half lose power
+      for (uint32_t i = 0; i + 4 <= len; i += 4)
+         *(uint32_t *) (in + i) = random ();    // New data, so old journeys cannot be mistaken for this one
+      FILE *o = lograw_open (region, bytes, block);
+      if (!o && !dead)
+         err (1, "Cannot make %s", region);
+      while (o && wrote < len && !dead)
+      {
+         uint32_t l = random () % 200 + 1;
+         if (l > len - wrote)
+            l = len - wrote;
+         if (fwrite (in + wrote, 1, l, o) != l)
+            break;
+         wrote += l;
+         if (!(random () % (syncbytes / 100 + 1)) && !lograw_sync (o))
+            synced = wrote;
+      }
+      if (o)
+         fclose (o);            // Else power lost writing sector 0
+      if (!dead)
+         synced = wrote;        // Closed
+      uint32_t got = 0;
+      FILE *i = lograw_reader (region, block);
+      if (i)
+      {
+         got = readall (i, out, data);
+         fclose (i);
+      }
+      if (got < synced || got > wrote || memcmp (in, out, got))
+      {
+         fails++;
+         warnx ("Trial %d failed: wrote %u, checkpoint at %u, power lost at sector %d, read %u%s", t, wrote, synced, dead ? sector : -1,
+                got, got <= wrote && memcmp (in, out, got) ? " (different)" : "");
+      } else if (debug)
+         warnx ("Trial %d: wrote %u, checkpoint at %u, %s, read %u", t, wrote, synced, dead ? "power lost" : "closed", got);
+      if (dead)
+      {
+         lost++;
+         lostbytes += wrote - got;
+      }
+      if (!i)
+         empty++;
+      if (random () % 2)
+      {                         // Made in to a log file, so region done, else left for next journey to write over
+         dead = 0;
+         cut = -1;
+         if (lograw_done (region))
+            err (1, "Cannot mark done");
+         if ((i = lograw_reader (region, block)))
+         {
+            fails++;
+            warnx ("Trial %d failed: journey still there when done", t);
+            fclose (i);
+         }
+      }
+   }
+   printf ("Power loss: %d trials, %d lost power (%llu bytes after checkpoints lost), %d nothing to read, %d failed\n", trials, lost,
+           (unsigned long long) lostbytes, empty, fails);
+   unlink (region);
+   free (in);
+   free (out);
+   poptFreeContext (optCon);
+   return fails ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+// Ramer-Douglas-Peucker point reduction of logged fixes, for host tools
+// Double precision ECEF, time scaled as distance, as json2gpx --rdp
+
+#include <stdio.h>
+#include <err.h>
+#include <math.h>
+#include "rdp.h"
+
+extern int debug;
+
+static double rdpdist = 0;
+static double rdptimescale = 0;
+
+static double
+dist2 (fix_t * A, fix_t * B)
+{                               // Distance between two fixes
+   double X = (A->ecef.x - B->ecef.x) / 1000000.0;
+   double Y = (A->ecef.y - B->ecef.y) / 1000000.0;
+   double Z = (A->ecef.z - B->ecef.z) / 1000000.0;
+   double T = 0;
+   if (rdptimescale)
+      T = (A->ecef.t - B->ecef.t) / 1000000.0 / rdptimescale;
+   return X * X + Y * Y + Z * Z + T * T;
+}
+
+static fix_t *
+findmax (fix_t * A, fix_t * B, double *dsqp)
+{
+   if (dsqp)
+      *dsqp = 0;
+   if (!A || !B || A == B || A->next == B)
+      return NULL;
+   double b2 = dist2 (B, A);
+   fix_t *m = NULL;
+   double best = 0;
+   for (fix_t * C = A->next; C && C != B; C = C->next)
+   {
+      double h2 = 0;
+      double a2 = dist2 (A, C),
+         c2 = 0;
+      if (b2 == 0.0)
+         h2 = a2;               // A/B same, so distance from A
+      else
+      {
+         c2 = dist2 (C, B);
+         if (c2 - b2 >= a2)
+            h2 = a2;            // Off end of A
+         else if (a2 - b2 >= c2)
+            h2 = c2;            // Off end of B
+         else
+            h2 = (4 * a2 * b2 - (a2 + b2 - c2) * (a2 + b2 - c2)) / (b2 * 4);    // see https://www.revk.uk/2024/01/distance-of-point-to-lie-in-four.html
+      }
+      if (m && h2 <= best)
+         continue;              // Not bigger
+      best = h2;
+      m = C;
+   }
+   if (dsqp)
+      *dsqp = best;
+   return m;
+}
+
+static void
+dordp (fix_t * j, fix_t * B)
+{
+   fix_t *A = NULL;
+   fix_t *L = NULL;
+   while (j && j != B)
+   {
+      if (!j->setecef)
+         j->deleted = 1;
+      else
+      {
+         if (!A)
+            A = j;
+         L = j;
+      }
+      j = j->next;
+   }
+   B = L;
+   if (!A || A == B || A->next == B)
+      return;
+   double dsq = 0;
+   fix_t *M = findmax (A, B, &dsq);
+   if (debug)
+      warnx ("%u-%u-%u %lf", A->seq, M ? M->seq : 0, B->seq, sqrt (dsq));
+   if (dsq >= rdpdist * rdpdist)
+   {
+      dordp (A, M);
+      dordp (M, B);
+   } else
+   {
+      while ((A = A->next) && A != B)
+         if (!A->waypoint)
+            A->deleted = 1;
+   }
+}
+
+void
+rdp (fix_t * A, fix_t * B, double metres, double timescale)
+{
+   rdpdist = metres;
+   rdptimescale = timescale;
+   dordp (A, B);
+}
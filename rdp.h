@@ -0,0 +1,5 @@
+// Ramer-Douglas-Peucker point reduction of logged fixes, for host tools
+
+#include "fix.h"
+
+void rdp (fix_t * A, fix_t * B, double metres, double timescale);      // Mark deleted fixes from A (linked by next) to before B (NULL for all) within metres of the line, waypoints kept
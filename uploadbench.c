@@ -0,0 +1,213 @@
+// Upload throughput - POST files to a local server (e.g. uploadserver) as the logger does, comparing the old 2K read/send
+// loop with the read ahead (sdread). On a host the disk and network are not the bottleneck, so card reads and TLS are
+// simulated by waiting at set speeds, card reads in the read task, TLS in the sending loop, as on the device.
+
+#include <stdio.h>
+#include <string.h>
+#include <popt.h>
+#include <time.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include "sdread.h"
+
+int debug = 0;
+int cardus = 1000;              // Card per read
+int cardkbps = 10000;           // Card KB/s
+int tlskbps = 1500;             // TLS and sending KB/s
+
+double
+now (void)
+{
+   struct timespec t;
+   clock_gettime (CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+void
+wait (uint64_t us)
+{
+   struct timespec t = {.tv_sec = us / 1000000,.tv_nsec = us % 1000000 * 1000 };
+   nanosleep (&t, NULL);
+}
+
+ssize_t
+sim_card (int fd, void *buf, size_t len)
+{                               // Card read, at card speed
+   ssize_t l = read (fd, buf, len);
+   if (l > 0)
+      wait (cardus + (uint64_t) l * 1000 / cardkbps);
+   return l;
+}
+
+typedef struct sim_s sim_t;
+struct sim_s
+{                               // Normal file
+   int fd;
+   char *buf;                   // stdio buffer
+};
+
+ssize_t
+sim_cookie (void *cookie, char *buf, size_t size)
+{                               // Normal file, at card speed
+   return sim_card (((sim_t *) cookie)->fd, buf, size);
+}
+
+int
+sim_close (void *cookie)
+{
+   sim_t *s = cookie;
+   int e = close (s->fd);
+   free (s->buf);
+   free (s);
+   return e;
+}
+
+FILE *
+sim_open (const char *filename, int block)
+{                               // Normal file, with stdio buffer the size of our reads, so a card read per fread, as on device
+   sim_t *s = malloc (sizeof (*s));
+   if (!s || !(s->buf = malloc (block)) || (s->fd = open (filename, O_RDONLY)) < 0)
+      err (1, "Cannot open %s", filename);
+   cookie_io_functions_t io = {.read = sim_cookie,.close = sim_close };
+   FILE *i = fopencookie (s, "r", io);
+   setvbuf (i, s->buf, _IOFBF, block);
+   return i;
+}
+
+int
+post (int s, FILE * i, off_t size, int block, const char *name)
+{                               // POST file, as logger, return response code
+   char *buf = malloc (block);
+   if (!buf)
+      errx (1, "malloc");
+   dprintf (s, "POST /?%s HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/octet-stream\r\nContent-Length: %lld\r\n\r\n", name,
+            (long long) size);
+   size_t l;
+   while ((l = fread (buf, 1, block, i)) > 0)
+   {
+      wait ((uint64_t) l * 1000 / tlskbps);
+      if (send (s, buf, l, MSG_NOSIGNAL) != l)
+         err (1, "send");
+   }
+   free (buf);
+   char r[1000];
+   size_t got = 0;
+   while (got < sizeof (r) - 1 && (l = recv (s, r + got, sizeof (r) - 1 - got, 0)) > 0)
+   {
+      got += l;
+      r[got] = 0;
+      if (strstr (r, "\r\n\r\n"))
+         break;
+   }
+   int code = 0;
+   if (sscanf (r, "HTTP/%*s %d", &code) != 1)
+      errx (1, "No response");
+   return code;
+}
+
+int
+main (int argc, const char *argv[])
+{
+   const char *host = "localhost";
+   const char *port = "8080";
+   int buffer = 32;
+   int block = 16384;
+   poptContext optCon;          // context for parsing command-line options
+   {                            // POPT
+      const struct poptOption optionsTable[] = {
+         {"host", 'h', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &host, 0, "Server", "host"},
+         {"port", 'p', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &port, 0, "Port", "port"},
+         {"buffer", 'b', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &buffer, 0, "Read ahead buffer size", "KiB"},
+         {"block", 0, POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &block, 0, "Send size with read ahead", "bytes"},
+         {"card-us", 0, POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &cardus, 0, "Card time per read", "us"},
+         {"card-kbps", 0, POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &cardkbps, 0, "Card read speed", "KB/s"},
+         {"tls-kbps", 0, POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &tlskbps, 0, "TLS and send speed", "KB/s"},
+         {"debug", 'v', POPT_ARG_NONE, &debug, 0, "Debug"},
+         POPT_AUTOHELP {}
+      };
+
+      optCon = poptGetContext (NULL, argc, argv, optionsTable, 0);
+      poptSetOtherOptionHelp (optCon, "[files] (default 1MiB and 10MiB)");
+
+      int c;
+      if ((c = poptGetNextOpt (optCon)) < -1)
+         errx (1, "%s: %s\n", poptBadOption (optCon, POPT_BADOPTION_NOALIAS), poptStrerror (c));
+      if (buffer < 1 || block < 1 || cardkbps < 1 || tlskbps < 1 || cardus < 0)
+         errx (1, "Bad settings");
+   }
+   const char *files[100];
+   int n = 0;
+   while (n < 100 && poptPeekArg (optCon))
+      files[n++] = poptGetArg (optCon);
+   char *made[2] = { 0 };
+   if (!n)
+   {                            // Make test files
+      for (int f = 0; f < 2; f++)
+      {
+         asprintf (&made[f], "/tmp/uploadbench-%dMiB", f ? 10 : 1);
+         FILE *o = fopen (made[f], "w");
+         if (!o)
+            err (1, "Cannot make %s", made[f]);
+         for (int b = 0; b < (f ? 10 : 1) * 1024 * 1024; b++)
+            fputc (random (), o);
+         fclose (o);
+         files[n++] = made[f];
+      }
+   }
+   struct addrinfo *a,
+     hints = {.ai_socktype = SOCK_STREAM };
+   if (getaddrinfo (host, port, &hints, &a))
+      errx (1, "Cannot find %s", host);
+   int s = socket (a->ai_family, a->ai_socktype, a->ai_protocol);
+   if (s < 0 || connect (s, a->ai_addr, a->ai_addrlen))
+      err (1, "Cannot connect to %s:%s", host, port);
+   freeaddrinfo (a);
+   printf ("Card %dus+%dKB/s, TLS %dKB/s, read ahead 2x%dKiB, send %d\n", cardus, cardkbps, tlskbps, buffer, block);
+   for (int f = 0; f < n; f++)
+   {
+      int fd = open (files[f], O_RDONLY);
+      if (fd < 0)
+         err (1, "Cannot open %s", files[f]);
+      off_t size = lseek (fd, 0, SEEK_END);
+      close (fd);
+      const char *base = strrchr (files[f], '/') ? strrchr (files[f], '/') + 1 : files[f];
+      double was = 0;
+      for (int mode = 0; mode < 3; mode++)
+      {                         // Old loop, old loop with bigger blocks, read ahead
+         const char *modes[] = { "2K loop", "big loop", "read ahead" };
+         sdread_card_read = sim_card;
+         memset (&sdread_stats, 0, sizeof (sdread_stats));
+         double t0 = now ();
+         FILE *i = mode == 2 ? sdread_open (files[f], buffer * 1024) : sim_open (files[f], mode ? block : 2048);
+         if (!i)
+            err (1, "Cannot open %s", files[f]);
+         char *name = NULL;
+         asprintf (&name, "bench-%d-%s", mode, base);
+         int code = post (s, i, size, mode ? block : 2048, name);
+         fclose (i);
+         free (name);
+         double t = now () - t0;
+         printf ("%s %lldB %-10s %6.3fs %6.2fMiB/s", base, (long long) size, modes[mode], t, size / t / 1024 / 1024);
+         if (mode)
+            printf (" x%.2f", was / t);
+         else
+            was = t;
+         if (mode == 2)
+            printf (" (card %.3fs, waited %.3fs)", sdread_stats.us / 1000000.0, sdread_stats.stallus / 1000000.0);
+         printf ("%s\n", code / 100 == 2 ? "" : " FAILED");
+      }
+   }
+   close (s);
+   for (int f = 0; f < 2; f++)
+      if (made[f])
+      {
+         unlink (made[f]);
+         free (made[f]);
+      }
+   poptFreeContext (optCon);
+   return 0;
+}
@@ -0,0 +1,541 @@
+// Upload test server - reference for what the logger POSTs, for testing uploads against a local server
+// Saves files in a directory. Handles a whole file as the body, multipart/form-data batches, and resumable chunks
+// Resumable: POST with Upload-Offset and Upload-Length headers and the bytes from that offset as the body. The server
+// keeps what it has in a .part file, appending as the bytes arrive, so even part of a chunk is kept if the connection
+// drops. The response has Upload-Offset, the bytes it now has, with 201 once complete, 204 if more is needed, or 409
+// if the offset was not what it has, and the client carries on from the Upload-Offset in the response.
+// Integrity and duplicates: a Repr-Digest (sha-256) header, on the request or a multipart part, is checked against what
+// arrived, 400 if it does not match. Files are indexed by SHA-256 (in .sha256 as links to the file), so a file already
+// saved is not saved again, and a HEAD with Repr-Digest is 200 if it has the file, 404 if not. Responses that have a
+// file, or just saved it, have Repr-Digest, so the client knows the server has exactly what it sent.
+
+#include <stdio.h>
+#include <string.h>
+#include <popt.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <openssl/evp.h>
+
+int debug = 0;
+const char *dir = "uploads";
+int drop = 0;                   // Drop connection this many bytes in to a body
+int drops = 1;                  // Number of times to drop
+
+typedef struct conn_s conn_t;
+struct conn_s
+{                               // Buffered connection
+   int s;
+   size_t len;
+   size_t pos;
+   char buf[16384];
+};
+
+int
+conn_fill (conn_t * c)
+{                               // More data, 0 if closed
+   if (c->pos == c->len)
+      c->pos = c->len = 0;
+   if (c->len == sizeof (c->buf))
+      return 0;
+   ssize_t l = recv (c->s, c->buf + c->len, sizeof (c->buf) - c->len, 0);
+   if (l <= 0)
+      return 0;
+   c->len += l;
+   return 1;
+}
+
+char *
+conn_line (conn_t * c)
+{                               // Read header line, NULL if closed
+   while (1)
+   {
+      char *e = memchr (c->buf + c->pos, '\n', c->len - c->pos);
+      if (e)
+      {
+         char *l = c->buf + c->pos;
+         c->pos = e + 1 - c->buf;
+         *e = 0;
+         if (e > l && e[-1] == '\r')
+            e[-1] = 0;
+         return l;
+      }
+      if (c->pos)
+      {                         // Move down
+         memmove (c->buf, c->buf + c->pos, c->len - c->pos);
+         c->len -= c->pos;
+         c->pos = 0;
+      }
+      if (!conn_fill (c))
+         return NULL;
+   }
+}
+
+size_t
+conn_body (conn_t * c, size_t len, FILE * o, char *mem)
+{                               // Read body, to file and/or memory, return bytes read, less than len if connection lost or dropped
+   size_t got = 0;
+   static int dropped = 0;
+   while (got < len)
+   {
+      if (c->pos == c->len && !conn_fill (c))
+         break;
+      size_t l = c->len - c->pos;
+      if (l > len - got)
+         l = len - got;
+      if (drop && dropped < drops && got + l > drop)
+      {                         // Simulate connection lost
+         l = (got < drop ? drop - got : 0);
+         if (o)
+            fwrite (c->buf + c->pos, 1, l, o);
+         got += l;
+         dropped++;
+         warnx ("Dropped connection at %zu", got);
+         break;
+      }
+      if (o && fwrite (c->buf + c->pos, 1, l, o) != l)
+         break;
+      if (mem)
+         memcpy (mem + got, c->buf + c->pos, l);
+      c->pos += l;
+      got += l;
+   }
+   if (o)
+      fflush (o);
+   return got;
+}
+
+#define	HASH	32              // SHA-256 size
+#define	HEX	(HASH*2+1)      // As hex string
+
+void
+reply (conn_t * c, int code, const char *text, long long offset, const char *hex, int close)
+{                               // Response, with Upload-Offset if offset not -1, and Repr-Digest if hex not NULL
+   char r[300];
+   int l = snprintf (r, sizeof (r), "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n", code, text);
+   if (offset >= 0)
+      l += snprintf (r + l, sizeof (r) - l, "Upload-Offset: %lld\r\n", offset);
+   if (hex && *hex)
+   {
+      unsigned char h[HASH],
+        b[HASH * 2];
+      for (int i = 0; i < HASH; i++)
+         sscanf (hex + i * 2, "%2hhx", &h[i]);
+      EVP_EncodeBlock (b, h, HASH);
+      l += snprintf (r + l, sizeof (r) - l, "Repr-Digest: sha-256=:%s:\r\n", b);
+   }
+   if (close)
+      l += snprintf (r + l, sizeof (r) - l, "Connection: close\r\n");
+   l += snprintf (r + l, sizeof (r) - l, "\r\n");
+   send (c->s, r, l, MSG_NOSIGNAL);
+   if (debug)
+      warnx ("%d %s%s", code, text, close ? " (close)" : "");
+}
+
+char *
+safe (const char *name)
+{                               // Safe file name in dir
+   char *n = NULL;
+   asprintf (&n, "%s/%s", dir, name);
+   for (char *p = n + strlen (dir) + 1; *p; p++)
+      if (!isalnum (*p) && *p != '.' && *p != '-')
+         *p = '-';
+   return n;
+}
+
+long long
+filesize (const char *fn)
+{
+   struct stat s;
+   if (stat (fn, &s))
+      return -1;
+   return s.st_size;
+}
+
+void
+digest (const char *v, char *hex)
+{                               // sha-256 from Repr-Digest header value, as hex, empty if none
+   *hex = 0;
+   const char *p = strstr (v, "sha-256=:");
+   if (!p)
+      return;
+   p += 9;
+   const char *e = strchr (p, ':');
+   unsigned char h[HASH * 2];
+   if (!e || e - p != 44 || EVP_DecodeBlock (h, (const unsigned char *) p, e - p) < HASH)
+      return;
+   for (int i = 0; i < HASH; i++)
+      sprintf (hex + i * 2, "%02x", h[i]);
+}
+
+void
+hash (FILE * i, const char *mem, size_t len, char *hex)
+{                               // SHA-256 of file or memory, as hex
+   EVP_MD_CTX *ctx = EVP_MD_CTX_new ();
+   EVP_DigestInit_ex (ctx, EVP_sha256 (), NULL);
+   if (i)
+   {
+      char buf[16384];
+      size_t l;
+      while ((l = fread (buf, 1, sizeof (buf), i)) > 0)
+         EVP_DigestUpdate (ctx, buf, l);
+   } else
+      EVP_DigestUpdate (ctx, mem, len);
+   unsigned char h[HASH];
+   EVP_DigestFinal_ex (ctx, h, NULL);
+   EVP_MD_CTX_free (ctx);
+   for (int i = 0; i < HASH; i++)
+      sprintf (hex + i * 2, "%02x", h[i]);
+}
+
+int
+filehash (const char *fn, char *hex)
+{                               // SHA-256 of file, as hex, -1 if cannot read
+   FILE *i = fopen (fn, "r");
+   if (!i)
+      return -1;
+   hash (i, NULL, 0, hex);
+   fclose (i);
+   return 0;
+}
+
+char *
+indexed (const char *hex)
+{                               // Index entry for SHA-256
+   char *n = NULL;
+   asprintf (&n, "%s/.sha256/%s", dir, hex);
+   return n;
+}
+
+int
+known (const char *hex)
+{                               // If we have a file with this SHA-256
+   if (!*hex)
+      return 0;
+   char *n = indexed (hex);
+   int r = (filesize (n) >= 0); // Link, to file still there
+   if (r && debug)
+      warnx ("Have %s", hex);
+   free (n);
+   return r;
+}
+
+void
+saved (const char *f, const char *hex)
+{                               // Index saved file by SHA-256
+   char *n = indexed (hex);
+   char *t = NULL;
+   asprintf (&t, "../%s", strrchr (f, '/') + 1);
+   unlink (n);
+   if (symlink (t, n))
+      warn ("Cannot index %s", f);
+   free (t);
+   free (n);
+}
+
+int
+request (conn_t * c, int *files)
+{                               // Handle a request, 0 to carry on with connection
+   char *l = conn_line (c);
+   if (!l)
+      return -1;
+   if (!*l)
+      return 0;                 // Stray blank line
+   char method[10] = "",
+      uri[1000] = "";
+   if (sscanf (l, "%9s %999s", method, uri) != 2)
+      return -1;
+   long long len = -1,
+      offset = -1,
+      total = -1;
+   int close = 0,
+      gz = 0;
+   char want[HEX] = "";         // Repr-Digest sha-256, as hex
+   char *boundary = NULL;
+   while ((l = conn_line (c)) && *l)
+   {
+      char *v = strchr (l, ':');
+      if (!v)
+         continue;
+      *v++ = 0;
+      while (*v == ' ')
+         v++;
+      if (!strcasecmp (l, "Content-Length"))
+         len = strtoll (v, NULL, 10);
+      else if (!strcasecmp (l, "Upload-Offset"))
+         offset = strtoll (v, NULL, 10);
+      else if (!strcasecmp (l, "Upload-Length"))
+         total = strtoll (v, NULL, 10);
+      else if (!strcasecmp (l, "Content-Encoding"))
+         gz = !strcasecmp (v, "gzip");
+      else if (!strcasecmp (l, "Connection"))
+         close = !strcasecmp (v, "close");
+      else if (!strcasecmp (l, "Repr-Digest"))
+         digest (v, want);
+      else if (!strcasecmp (l, "Content-Type") && !strncasecmp (v, "multipart/form-data", 19) && (v = strstr (v, "boundary=")))
+         boundary = strdup (v + 9);
+   }
+   if (!l)
+   {
+      free (boundary);
+      return -1;
+   }
+   char *q = strchr (uri, '?');
+   if (!strcmp (method, "HEAD") && q && q[1])
+   {                            // Do we have it
+      if (debug)
+         warnx ("HEAD %s %s", q + 1, *want ? want : "(no digest)");
+      if (known (want))
+         reply (c, 200, "OK", -1, want, close);
+      else
+         reply (c, 404, "Not found", -1, NULL, close);
+      free (boundary);
+      return close;
+   }
+   if (strcmp (method, "POST") || !q || !q[1] || len < 0)
+   {
+      reply (c, 400, "Bad request", -1, NULL, 1);
+      free (boundary);
+      return -1;
+   }
+   q++;
+   if (debug)
+      warnx ("POST %s %lld bytes%s", q, len, offset >= 0 ? " (resumable)" : boundary ? " (batch)" : "");
+   int e = 0;
+   if (boundary)
+   {                            // Batch, in memory
+      char *mem = malloc (len + 1);
+      if (!mem)
+         errx (1, "malloc");
+      if (conn_body (c, len, NULL, mem) != len)
+         e = -1;
+      else
+      {
+         mem[len] = 0;
+         char *b = NULL;
+         asprintf (&b, "--%s", boundary);
+         char *p = mem,
+            *end = mem + len;
+         int parts = 0,
+            bad = 0;
+         while ((p = memmem (p, end - p, b, strlen (b))) && p + strlen (b) + 2 <= end && strncmp (p + strlen (b), "--", 2))
+         {
+            p += strlen (b);
+            char *h = strstr (p, "\r\n\r\n");
+            if (!h)
+               break;
+            *h = 0;
+            char *fn = strstr (p, "filename=\"");
+            char *data = h + 4;
+            char *next = memmem (data, end - data, b, strlen (b));
+            if (!fn || !next || next - data < 2)
+               break;
+            fn += 10;
+            char partwant[HEX] = "",
+               got[HEX];
+            char *d = strcasestr (p, "\nRepr-Digest:");
+            if (d)
+               digest (d + 13, partwant);
+            *strchrnul (fn, '"') = 0;
+            char *n = NULL;
+            asprintf (&n, "%s-%s", q, fn);
+            char *f = safe (n);
+            hash (NULL, data, next - data - 2, got);
+            if (*partwant && strcmp (partwant, got))
+            {
+               warnx ("Digest mismatch %s", f);
+               bad++;
+            } else if (known (got))
+               warnx ("Already have %s (batch)", f);
+            else
+            {
+               FILE *o = fopen (f, "w");
+               if (!o || fwrite (data, next - data - 2, 1, o) != 1 || fclose (o))
+                  err (1, "Cannot write %s", f);
+               saved (f, got);
+               warnx ("Saved %s (%ld bytes, batch)", f, (long) (next - data - 2));
+               (*files)++;
+            }
+            free (f);
+            free (n);
+            parts++;
+            p = next;
+         }
+         free (b);
+         if (!parts)
+            e = 1;
+         else if (bad)
+            e = 2;
+      }
+      free (mem);
+      if (e < 0)
+         return -1;
+      if (e)
+         reply (c, 400, e == 2 ? "Digest mismatch" : "Bad batch", -1, NULL, close);   // Good parts are kept, so not saved again when sent again
+      else
+         reply (c, 200, "OK", -1, NULL, close);
+   } else
+   {
+      char *n = NULL;
+      asprintf (&n, "%s%s", q, gz && (strlen (q) < 3 || strcmp (q + strlen (q) - 3, ".gz")) ? ".gz" : "");
+      char *f = safe (n);
+      free (n);
+      if (offset >= 0)
+      {                         // Resumable
+         char *part = NULL;
+         asprintf (&part, "%s.part", f);
+         long long have = filesize (part);
+         if (have < 0)
+            have = ((total >= 0 && filesize (f) == total) || (total >= 0 && known (want))) ? total : 0;     // Already complete, or new
+         if (offset != have || total < 0 || offset + len > total)
+         {                      // Not where we are, discard body
+            if (conn_body (c, len, NULL, NULL) != len)
+               e = -1;
+            else
+               reply (c, 409, "Conflict", have, have == total ? want : NULL, close);
+         } else
+         {
+            FILE *o = fopen (part, "a");
+            if (!o)
+               err (1, "Cannot write %s", part);
+            if (conn_body (c, len, o, NULL) != len)
+               e = -1;          // Keep what we got
+            fclose (o);
+            have = filesize (part);
+            if (!e)
+            {
+               char got[HEX];
+               if (have == total && (filehash (part, got) || (*want && strcmp (want, got))))
+               {                // Start again
+                  warnx ("Digest mismatch %s", f);
+                  unlink (part);
+                  reply (c, 400, "Digest mismatch", 0, NULL, close);
+               } else if (have == total)
+               {
+                  if (rename (part, f))
+                     err (1, "Cannot rename %s", part);
+                  saved (f, got);
+                  warnx ("Saved %s (%lld bytes, resumable)", f, have);
+                  (*files)++;
+                  reply (c, 201, "Created", have, got, close);
+               } else
+                  reply (c, 204, "No content", have, NULL, close);
+            } else if (debug)
+               warnx ("Have %lld of %s", have, f);
+         }
+         free (part);
+      } else
+      {                         // Whole file
+         char *tmp = NULL;
+         asprintf (&tmp, "%s.tmp", f);
+         if (known (want))
+         {                      // Already have it, e.g. sent again as response lost
+            if (conn_body (c, len, NULL, NULL) != len)
+               e = -1;
+            else
+            {
+               warnx ("Already have %s", f);
+               reply (c, 200, "OK", -1, want, close);
+            }
+         } else
+         {
+            FILE *o = fopen (tmp, "w");
+            if (!o)
+               err (1, "Cannot write %s", tmp);
+            if (conn_body (c, len, o, NULL) != len)
+               e = -1;
+            fclose (o);
+            char got[HEX];
+            if (e)
+               unlink (tmp);
+            else if (filehash (tmp, got) || (*want && strcmp (want, got)))
+            {
+               warnx ("Digest mismatch %s", f);
+               unlink (tmp);
+               reply (c, 400, "Digest mismatch", -1, NULL, close);
+            } else
+            {
+               if (rename (tmp, f))
+                  err (1, "Cannot rename %s", tmp);
+               saved (f, got);
+               warnx ("Saved %s (%lld bytes)", f, len);
+               (*files)++;
+               reply (c, 200, "OK", -1, got, close);
+            }
+         }
+         free (tmp);
+      }
+      free (f);
+   }
+   free (boundary);
+   return e ? : close;
+}
+
+int
+main (int argc, const char *argv[])
+{
+   int port = 8080;
+   poptContext optCon;          // context for parsing command-line options
+   {                            // POPT
+      const struct poptOption optionsTable[] = {
+         {"port", 'p', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &port, 0, "Port", "N"},
+         {"dir", 'd', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &dir, 0, "Directory for uploaded files", "path"},
+         {"drop", 0, POPT_ARG_INT, &drop, 0, "Drop connection this far in to a request body", "bytes"},
+         {"drops", 0, POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT, &drops, 0, "Times to drop connection", "N"},
+         {"debug", 'v', POPT_ARG_NONE, &debug, 0, "Debug"},
+         POPT_AUTOHELP {}
+      };
+
+      optCon = poptGetContext (NULL, argc, argv, optionsTable, 0);
+
+      int c;
+      if ((c = poptGetNextOpt (optCon)) < -1)
+         errx (1, "%s: %s\n", poptBadOption (optCon, POPT_BADOPTION_NOALIAS), poptStrerror (c));
+
+      if (poptPeekArg (optCon))
+      {
+         poptPrintUsage (optCon, stderr, 0);
+         return -1;
+      }
+   }
+   if (mkdir (dir, 0777) && errno != EEXIST)
+      err (1, "Cannot make %s", dir);
+   {                            // SHA-256 index
+      char *n = indexed ("");
+      if (mkdir (n, 0777) && errno != EEXIST)
+         err (1, "Cannot make %s", n);
+      free (n);
+   }
+   int s = socket (AF_INET6, SOCK_STREAM, 0);
+   if (s < 0)
+      err (1, "socket");
+   int on = 1;
+   setsockopt (s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+   struct sockaddr_in6 a = {.sin6_family = AF_INET6,.sin6_port = htons (port),.sin6_addr = in6addr_any };
+   if (bind (s, (struct sockaddr *) &a, sizeof (a)) || listen (s, 5))
+      err (1, "Cannot listen on port %d", port);
+   warnx ("Listening on port %d, saving to %s", port, dir);
+   while (1)
+   {                            // One connection at a time, as the logger only makes one
+      conn_t *c = malloc (sizeof (*c));
+      if (!c)
+         errx (1, "malloc");
+      memset (c, 0, sizeof (*c));
+      if ((c->s = accept (s, NULL, NULL)) < 0)
+         err (1, "accept");
+      int requests = 0,
+         files = 0;
+      while (!request (c, &files))
+         requests++;
+      close (c->s);
+      free (c);
+      warnx ("Connection closed after %d requests, %d files", requests, files);
+   }
+   poptFreeContext (optCon);
+   return 0;
+}